@@ -1,6 +1,7 @@
 
 #include "hacomponent.h"
 #include <math.h>
+#include <cmath>
 #include <ArduinoJson.h>
 
 extern Stream& Debug;
@@ -9,375 +10,2369 @@ template<Component c> const char* HACompBase<c>::m_component
 template<>            const char* HACompBase<Component::Sensor>::m_component        = "sensor";
 template<>            const char* HACompBase<Component::BinarySensor>::m_component  = "binary_sensor";
 template<>            const char* HACompBase<Component::Switch>::m_component        = "switch";
-
-template<SensorClass c> const char* SensorClassString<c>::name = nullptr;
-template<>              const char* SensorClassString<SensorClass::Undefined>::name = nullptr;
-template<>              const char* SensorClassString<SensorClass::Temperature>::name = "temperature";
-template<>              const char* SensorClassString<SensorClass::Humidity>::name = "humidity";
-template<>              const char* SensorClassString<SensorClass::Battery>::name = "battery";
-template<>              const char* SensorClassString<SensorClass::Illuminance>::name = "illuminance";
-template<>              const char* SensorClassString<SensorClass::Pressure>::name = "pressure";
-template<>              const char* SensorClassString<SensorClass::Power>::name = "power";
-template<>              const char* SensorClassString<SensorClass::Energy>::name = "energy";
-template<>              const char* SensorClassString<SensorClass::Voltage>::name = "voltage";
-
-// template<BinarySensorClass c> const char* BinarySensorClass<c>::name = nullptr;
-// template<>                    const char* BinarySensorClass<BinarySensorClass::connectivity>::name = "connectivity";
-// // TODO...
+template<>            const char* HACompBase<Component::Counter>::m_component       = "sensor";
+
+// Device class and unit names, kept in flash and passed to ArduinoJson as
+// flash strings (FPSTR), which copies them into the JSON buffer
+static const char s_battery[]       PROGMEM = "battery";
+static const char s_cold[]          PROGMEM = "cold";
+static const char s_connectivity[]  PROGMEM = "connectivity";
+static const char s_door[]          PROGMEM = "door";
+static const char s_energy[]        PROGMEM = "energy";
+static const char s_garage_door[]   PROGMEM = "garage_door";
+static const char s_gas[]           PROGMEM = "gas";
+static const char s_heat[]          PROGMEM = "heat";
+static const char s_humidity[]      PROGMEM = "humidity";
+static const char s_illuminance[]   PROGMEM = "illuminance";
+static const char s_light[]         PROGMEM = "light";
+static const char s_lock[]          PROGMEM = "lock";
+static const char s_moisture[]      PROGMEM = "moisture";
+static const char s_motion[]        PROGMEM = "motion";
+static const char s_moving[]        PROGMEM = "moving";
+static const char s_occupancy[]     PROGMEM = "occupancy";
+static const char s_opening[]       PROGMEM = "opening";
+static const char s_plug[]          PROGMEM = "plug";
+static const char s_power[]         PROGMEM = "power";
+static const char s_presence[]      PROGMEM = "presence";
+static const char s_pressure[]      PROGMEM = "pressure";
+static const char s_problem[]       PROGMEM = "problem";
+static const char s_safety[]        PROGMEM = "safety";
+static const char s_smoke[]         PROGMEM = "smoke";
+static const char s_sound[]         PROGMEM = "sound";
+static const char s_temperature[]   PROGMEM = "temperature";
+static const char s_vibration[]     PROGMEM = "vibration";
+static const char s_voltage[]       PROGMEM = "voltage";
+static const char s_window[]        PROGMEM = "window";
+
+static const char s_unit_none[]     PROGMEM = "";
+static const char s_unit_percent[]  PROGMEM = "%";
+static const char s_unit_lux[]      PROGMEM = "lx";
+static const char s_unit_celsius[]  PROGMEM = "°C";
+static const char s_unit_mbar[]     PROGMEM = "mbar";   // "hPa"
+static const char s_unit_wh[]       PROGMEM = "Wh";
+static const char s_unit_w[]        PROGMEM = "W";
+static const char s_unit_v[]        PROGMEM = "V";
+static const char s_unit_dust[]     PROGMEM = "ug/m³";
+static const char s_unit_ppm[]      PROGMEM = "ppm";
+static const char s_unit_ppb[]      PROGMEM = "ppb";
+
+// Device class and units for each SensorClass, in declaration order
+struct SensorClassInfo {
+    const char* device_class;
+    const char* units;
+};
+
+static const SensorClassInfo s_sensor_classes[] PROGMEM = {
+    { nullptr,          s_unit_none },      // Undefined
+    { s_battery,        s_unit_percent },
+    { s_humidity,       s_unit_percent },
+    { s_illuminance,    s_unit_lux },
+    { s_temperature,    s_unit_celsius },
+    { s_pressure,       s_unit_mbar },
+    { s_energy,         s_unit_wh },
+    { s_power,          s_unit_w },
+    { s_voltage,        s_unit_v },
+    // Custom classes with predefined units
+    { nullptr,          s_unit_dust },      // Dust
+    { nullptr,          s_unit_ppm },
+    { nullptr,          s_unit_ppb },
+};
+static_assert(sizeof(s_sensor_classes) / sizeof(s_sensor_classes[0]) == (size_t)SensorClass::PPB + 1,
+              "s_sensor_classes must match SensorClass");
+
+// Device class for each BinarySensorClass, in declaration order
+static const char* const s_binary_sensor_classes[] PROGMEM = {
+    s_battery,
+    s_cold,
+    s_connectivity,
+    s_door,
+    s_garage_door,
+    s_gas,
+    s_heat,
+    s_light,
+    s_lock,
+    s_moisture,
+    s_motion,
+    s_moving,
+    s_occupancy,
+    s_opening,
+    s_plug,
+    s_power,
+    s_presence,
+    s_problem,
+    s_safety,
+    s_smoke,
+    s_sound,
+    s_vibration,
+    s_window,
+};
+static_assert(sizeof(s_binary_sensor_classes) / sizeof(s_binary_sensor_classes[0]) == (size_t)BinarySensorClass::Undefined,
+              "s_binary_sensor_classes must match BinarySensorClass");
 
 // Static instantiations
-std::vector<HACompItem*>                        HACompItem::m_components;
-std::vector<HAComponent<Component::Switch>*>    HAComponent<Component::Switch>::m_switches;
-static HAComponent<Component::BinarySensor>*    s_component = nullptr;
+HACompItem*                                     HACompItem::m_components = nullptr;
+HACompItem*                                     HACompItem::m_components_tail = nullptr;
+HAComponent<Component::Switch>*                 HAComponent<Component::Switch>::m_switches = nullptr;
+size_t                                          HAComponent<Component::Switch>::m_switch_count = 0;
+#ifdef HA_NO_HEAP
+HAComponent<Component::Switch>*                 HAComponent<Component::Switch>::m_dispatch[HA_SWITCH_DISPATCH_SIZE];
+#else
+std::vector<HAComponent<Component::Switch>*>    HAComponent<Component::Switch>::m_dispatch;
+#endif
+size_t                                          HAComponent<Component::Switch>::m_dispatch_size = 0;
+bool                                            HACompItem::m_config_diff = false;
+HAConfigStats                                   HACompItem::m_config_stats = { 0, 0, 0 };
+HAStats                                         HACompItem::m_global_stats = { };
+uint32_t                                        HACompItem::m_latency_hist[HA_LATENCY_BUCKETS];
+unsigned long                                   HACompItem::m_state_refresh = HA_STATE_REFRESH_MS;
+HAEventQueue*                                   HAEventQueue::s_queues = nullptr;
+uint32_t                                        HACompItem::m_connect_epoch = 1;
 
 // Warning: HomeAssistant is case sensitive! These are the default state values...
 const char*                                     HAComponent<Component::Switch>::ON = "ON";
 const char*                                     HAComponent<Component::Switch>::OFF = "OFF";
 
+HACompItem*                                     HAComponentManager::s_config_cursor = nullptr;
+bool                                            HAComponentManager::s_config_present = true;
+bool                                            HAComponentManager::s_config_syncing = false;
+unsigned long                                   HAComponentManager::s_config_sync_start = 0;
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+bool                                            HAComponentManager::s_device_discovery = false;
+ComponentContext*                               HAComponentManager::s_device_cursor = nullptr;
+#endif
+ComponentContext*                               HAComponentManager::s_contexts = nullptr;
+ComponentContext*                               HAComponentManager::s_loop_contexts = nullptr;
+bool                                            HAComponentManager::s_rediscover_on_birth = false;
+#if HA_CONFIG_CACHE_SIZE > 0
+uint8_t                                         HAComponentManager::s_config_cache[HA_CONFIG_CACHE_SIZE];
+size_t                                          HAComponentManager::s_config_cache_used = 0;
+#endif
+bool                                            HAComponentManager::s_rediscover_pending = false;
+unsigned long                                   HAComponentManager::s_rediscover_at = 0;
+#ifdef HA_NO_HEAP
+ComponentContext*                               HAComponentManager::s_context_table[HA_CONTEXT_TABLE_SIZE];
+#else
+std::vector<ComponentContext*>                  HAComponentManager::s_context_table;
+#endif
+size_t                                          HAComponentManager::s_context_table_size = 0;
+HATimer*                                        HAComponentManager::s_wheel[HA_TIMER_WHEEL_SLOTS];
+unsigned long                                   HAComponentManager::s_wheel_tick = 0;
+bool                                            HAComponentManager::s_scheduling = false;
+uint32_t                                        (*HAComponentManager::s_time_source)() = nullptr;
+
+HASensorGroup*                                  HASensorGroup::s_groups = nullptr;
+
+#if HA_OFFLINE_BUFFER_SIZE > 0
+HAOfflineBuffer::Sample                         HAOfflineBuffer::s_samples[HA_OFFLINE_BUFFER_SIZE];
+size_t                                          HAOfflineBuffer::s_head = 0;
+size_t                                          HAOfflineBuffer::s_count = 0;
+uint32_t                                        HAOfflineBuffer::s_dropped = 0;
+#endif
+
 HAAvailabilityComponent*                        HAAvailabilityComponent::inst = nullptr;
 const char*                                     HAAvailabilityComponent::ONLINE = "online";
 const char*                                     HAAvailabilityComponent::OFFLINE = "offline";
 
+// FNV-1a, used for hashing topics
+static uint32_t hashString(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    while (length--) {
+        hash ^= (uint8_t)*data++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Print sink that hashes everything written to it (FNV-1a, as above)
+class HashPrint : public Print {
+public:
+    uint32_t hash = 2166136261u;
+
+    size_t write(uint8_t c) override {
+        hash ^= c;
+        hash *= 16777619u;
+        return 1;
+    }
+};
+
+// Print sink writing into a fixed buffer, dropping what doesn't fit
+class BufferPrint : public Print {
+public:
+    uint8_t* buffer;
+    size_t size;
+    size_t length = 0;
+
+    BufferPrint(uint8_t* buffer, size_t size) : buffer(buffer), size(size) { }
+
+    size_t write(uint8_t c) override {
+        if (length >= size) {
+            return 0;
+        }
+        buffer[length++] = c;
+        return 1;
+    }
+};
+
+// Print sink that only counts the bytes written to it
+class LengthPrint : public Print {
+public:
+    size_t length = 0;
+
+    size_t write(uint8_t c) override {
+        length++;
+        return 1;
+    }
+};
+
+// Print sink collecting small writes (eg. ArduinoJson's output, a token at a time)
+// into HA_PUBLISH_CHUNK_SIZE chunks for the underlying Print. Call flush() when done.
+class ChunkPrint : public Print {
+public:
+    ChunkPrint(Print& out) : out(out) { }
+
+    size_t write(uint8_t c) override {
+        if (length == sizeof(buffer)) {
+            flush();
+        }
+        buffer[length++] = c;
+        return 1;
+    }
+
+    size_t write(const uint8_t* data, size_t size) override {
+        size_t n = size;
+        while (size > 0) {
+            if (length == sizeof(buffer)) {
+                flush();
+            }
+            size_t count = sizeof(buffer) - length;
+            if (count > size) {
+                count = size;
+            }
+            memcpy(&buffer[length], data, count);
+            length += count;
+            data += count;
+            size -= count;
+        }
+        return n;
+    }
+
+    void flush() {
+        if (length > 0) {
+            out.write(buffer, length);
+            length = 0;
+        }
+    }
+
+private:
+    Print& out;
+    uint8_t buffer[HA_PUBLISH_CHUNK_SIZE];
+    size_t length = 0;
+};
+
+void HACompItem::registerItem(HACompItem* item) {
+    // Append, so components are published in the order they were declared
+    if (m_components_tail != nullptr) {
+        m_components_tail->m_next = item;
+    } else {
+        m_components = item;
+    }
+    m_components_tail = item;
+}
+
+void HACompItem::recordLatency(unsigned long us) {
+    size_t bucket = 0;
+    while (us > 1 && bucket < HA_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    m_latency_hist[bucket]++;
+}
+
+void HAComponentManager::initializeAll() {
+    // Groups first, as sensors take their state topic from them
+    for (auto group = HASensorGroup::s_groups; group != nullptr; group = group->m_next) {
+        group->initialize();
+    }
+
+    char topic[TOPIC_BUFFER_SIZE];
+    for (auto item = HACompItem::m_components; item != nullptr; item = item->m_next) {
+        item->initialize();
+
+        item->getConfigTopic(topic, sizeof(topic));
+        item->m_config_topic_hash = hashString(topic, strlen(topic));
+    }
+
+    buildContexts();
+    HAComponent<Component::Switch>::buildDispatchTable();
+#if HA_CONFIG_CACHE_SIZE > 0
+    buildConfigCache();
+#endif
+}
+
+// Build the per-device component lists and the device name lookup table.
+// Done here rather than at registration, as static initialization order
+// between contexts and components isn't guaranteed.
+void HAComponentManager::buildContexts() {
+    for (auto item = HACompItem::m_components; item != nullptr; item = item->m_next) {
+        ComponentContext& context = item->getContext();
+        context.m_components = nullptr;
+        context.m_components_tail = nullptr;
+        context.m_registered = false;
+    }
+
+    s_contexts = nullptr;
+    ComponentContext* contexts_tail = nullptr;
+    size_t count = 0;
+    for (auto item = HACompItem::m_components; item != nullptr; item = item->m_next) {
+        ComponentContext& context = item->getContext();
+        if (!context.m_registered) {
+            context.m_registered = true;
+            context.m_next = nullptr;
+            context.m_name_hash = hashString(context.device_name, strlen(context.device_name));
+            if (contexts_tail != nullptr) {
+                contexts_tail->m_next = &context;
+            } else {
+                s_contexts = &context;
+            }
+            contexts_tail = &context;
+            count++;
+        }
+
+        item->m_context_next = nullptr;
+        if (context.m_components_tail != nullptr) {
+            context.m_components_tail->m_context_next = item;
+        } else {
+            context.m_components = item;
+        }
+        context.m_components_tail = item;
+    }
+
+    size_t size = 1;
+    while (size < count * 2) {
+        size <<= 1;
+    }
+#ifdef HA_NO_HEAP
+    if (size > HA_CONTEXT_TABLE_SIZE) {
+        size = HA_CONTEXT_TABLE_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        s_context_table[i] = nullptr;
+    }
+#else
+    s_context_table.assign(size, nullptr);
+#endif
+    s_context_table_size = size;
+
+    for (auto context = s_contexts; context != nullptr; context = context->m_next) {
+        auto& bucket = s_context_table[context->m_name_hash & (size - 1)];
+        context->m_hash_next = bucket;
+        bucket = context;
+    }
+
+    // One context per transport (or client) for service() to loop(),
+    // so a bridge with many devices on one connection loops it once
+    s_loop_contexts = nullptr;
+    ComponentContext* loop_tail = nullptr;
+    for (auto context = s_contexts; context != nullptr; context = context->m_next) {
+        const void* key = context->getLoopKey();
+        bool found = false;
+        for (auto other = s_loop_contexts; other != nullptr && !found; other = other->m_loop_next) {
+            found = (other->getLoopKey() == key);
+        }
+        if (!found) {
+            context->m_loop_next = nullptr;
+            if (loop_tail != nullptr) {
+                loop_tail->m_loop_next = context;
+            } else {
+                s_loop_contexts = context;
+            }
+            loop_tail = context;
+        }
+    }
+}
+
+ComponentContext* HAComponentManager::findContext(const char* device_name, size_t length) {
+    if (s_context_table_size == 0) {
+        return nullptr;
+    }
+    uint32_t hash = hashString(device_name, length);
+    for (auto context = s_context_table[hash & (s_context_table_size - 1)]; context != nullptr; context = context->m_hash_next) {
+        if (context->m_name_hash == hash &&
+            strncmp(context->device_name, device_name, length) == 0 &&
+            context->device_name[length] == '\0') {
+            return context;
+        }
+    }
+    return nullptr;
+}
+
+void HAComponentManager::publishConfigAll(ComponentContext& context, bool present) {
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+    if (s_device_discovery && publishDeviceConfig(context, present) != DeviceConfigResult::TooLarge) {
+        return;
+    }
+#endif
+
+    for (auto item = context.m_components; item != nullptr; item = item->m_context_next) {
+        item->publishConfig(present);
+    }
+}
+
+void HAComponentManager::publishConfigAll(bool present) {
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+    if (s_device_discovery) {
+        // Each device decides on its own whether it fits a device config
+        for (auto context = s_contexts; context != nullptr; context = context->m_next) {
+            publishConfigAll(*context, present);
+        }
+        return;
+    }
+#endif
+
+    for (auto item = HACompItem::m_components; item != nullptr; item = item->m_next) {
+        item->publishConfig(present);
+    }
+}
+
+void HAComponentManager::requestConfigAll(bool present) {
+    s_config_present = present;
+    s_config_cursor = HACompItem::m_components;
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+    s_device_cursor = nullptr;
+    if (s_device_discovery) {
+        // Walked one device at a time by serviceDeviceConfigs()
+        s_device_cursor = s_contexts;
+        s_config_cursor = nullptr;
+    }
+#endif
+
+    if (m_config_diff && present) {
+        // Collect what the broker currently has retained before publishing
+        for (auto item = HACompItem::m_components; item != nullptr; item = item->m_next) {
+            item->m_retained = false;
+        }
+        subscribeConfigs(true);
+        s_config_syncing = true;
+        s_config_sync_start = millis();
+    }
+}
+
+// (Un)subscribe to the config topics of every device with registered components
+void HAComponentManager::subscribeConfigs(bool subscribe) {
+    char topic[TOPIC_BUFFER_SIZE];
+    for (auto context = s_contexts; context != nullptr; context = context->m_next) {
+        snprintf(topic, sizeof(topic),
+            HA_CONFIG_TOPIC("+", "%s", "+"),
+            context->device_name);
+        if (subscribe) {
+            context->transport.subscribe(topic);
+        } else {
+            context->transport.unsubscribe(topic);
+        }
+    }
+}
+
+// Record the hash of a retained config, or remove it if no component owns it.
+// Returns false if the topic is not a config topic.
+bool HAComponentManager::processRetainedConfig(const char* topic, const byte* payload, unsigned int length) {
+    static const char prefix[] = "homeassistant/";
+    static const char suffix[] = "/config";
+    size_t topic_len = strlen(topic);
+    if (topic_len <= sizeof(prefix) + sizeof(suffix) ||
+        strncmp(topic, prefix, sizeof(prefix) - 1) != 0 ||
+        strcmp(topic + topic_len - (sizeof(suffix) - 1), suffix) != 0) {
+        return false;
+    }
+
+    if (length == 0) {
+        // Already unpublished
+        return true;
+    }
+
+    // homeassistant/<platform>/<device>/<id>/config
+    const char* device = strchr(topic + sizeof(prefix) - 1, '/');
+    const char* device_end = (device != nullptr) ? strchr(device + 1, '/') : nullptr;
+    if (device_end == nullptr) {
+        return true;
+    }
+    device++;
+    ComponentContext* context = findContext(device, device_end - device);
+    if (context == nullptr) {
+        return true;
+    }
+
+    char item_topic[TOPIC_BUFFER_SIZE];
+    uint32_t topic_hash = hashString(topic, topic_len);
+    for (auto item = context->m_components; item != nullptr; item = item->m_context_next) {
+        if (item->m_config_topic_hash != topic_hash) {
+            continue;
+        }
+        item->getConfigTopic(item_topic, sizeof(item_topic));
+        if (strcmp(item_topic, topic) == 0) {
+            item->m_retained_hash = hashString((const char*)payload, length);
+            item->m_retained = true;
+            return true;
+        }
+    }
+
+    // Orphaned config, no component matches it anymore.
+    // Copy the topic first since it lives in the client buffer we are about to publish from.
+    if (topic_len < sizeof(item_topic)) {
+        memcpy(item_topic, topic, topic_len + 1);
+        Debug.print("unpublish orphan: ");
+        Debug.println(item_topic);
+
+        if (context->transport.publish(item_topic, nullptr, 0, true)) {
+            m_config_stats.removed++;
+        }
+    }
+    return true;
+}
+
+void HAComponentManager::schedule(HATimer& timer) {
+    if (timer.scheduled) {
+        return;
+    }
+    unsigned long now = millis();
+    if (!s_scheduling) {
+        s_wheel_tick = now / HA_TIMER_TICK_MS;
+    }
+    timer.advance(now);
+    timer.scheduled = true;
+    insertTimer(timer);
+}
+
+void HAComponentManager::insertTimer(HATimer& timer) {
+    HATimer*& slot = s_wheel[(timer.deadline / HA_TIMER_TICK_MS) % HA_TIMER_WHEEL_SLOTS];
+    timer.next = slot;
+    slot = &timer;
+}
+
+// Visit every wheel slot passed since the last call and fire the due timers.
+// Timers in a slot that aren't due yet belong to a later rotation of the wheel.
+void HAComponentManager::runScheduler(unsigned long now) {
+    unsigned long tick = now / HA_TIMER_TICK_MS;
+    unsigned long ticks = tick - s_wheel_tick;
+    if (ticks == 0) {
+        return;
+    }
+    if (ticks > HA_TIMER_WHEEL_SLOTS) {
+        // Fell behind (or millis() wrapped), visit every slot once
+        ticks = HA_TIMER_WHEEL_SLOTS;
+    }
+
+    for (unsigned long t = tick - ticks + 1; ticks > 0; t++, ticks--) {
+        HATimer*& slot = s_wheel[t % HA_TIMER_WHEEL_SLOTS];
+        HATimer* timer = slot;
+        slot = nullptr;
+
+        while (timer != nullptr) {
+            HATimer* next = timer->next;
+            if (timer->due(now)) {
+                timer->owner->onTimer(now);
+                timer->advance(now);
+            }
+            insertTimer(*timer);
+            timer = next;
+        }
+    }
+    s_wheel_tick = tick;
+
+    // Sensor groups updated by the timers above go out as one message each
+    HASensorGroup::flushAll();
+}
+
+bool HAComponentManager::service(unsigned int max_messages) {
+    unsigned long now = millis();
+    HAEventQueue::drainAll();
+    runScheduler(now);
+    s_scheduling = true;
+
+    for (auto context = s_loop_contexts; context != nullptr; context = context->m_loop_next) {
+        context->transport.loop();
+    }
+
+    if (s_rediscover_pending && (long)(now - s_rediscover_at) >= 0) {
+        s_rediscover_pending = false;
+        requestConfigAll(true);
+    }
+
+#if HA_OFFLINE_BUFFER_SIZE > 0
+    if (HAOfflineBuffer::size() > 0) {
+        HAOfflineBuffer::replay(HA_OFFLINE_REPLAY_BATCH);
+    }
+#endif
+
+    if (s_config_syncing) {
+        if (now - s_config_sync_start < HA_CONFIG_SYNC_MS) {
+            return false;
+        }
+        subscribeConfigs(false);
+        s_config_syncing = false;
+    }
+
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+    if (s_device_cursor != nullptr) {
+        return serviceDeviceConfigs(max_messages);
+    }
+#endif
+
+    while (s_config_cursor != nullptr && max_messages > 0) {
+        if (!s_config_cursor->publishConfig(s_config_present)) {
+            // Try this component again next time (eg. after reconnecting)
+            return false;
+        }
+        s_config_cursor = s_config_cursor->m_next;
+        max_messages--;
+    }
+    return (s_config_cursor == nullptr);
+}
+
+// Case-insensitive comparison of a (non NUL-terminated) payload
+static bool payloadEquals(const byte* payload, unsigned int length, const char* value) {
+    return (strlen(value) == length) && (strncasecmp((const char*)payload, value, length) == 0);
+}
+
 void HAComponentManager::onMessageReceived(char* topic, byte* payload, unsigned int length) {
-    payload[length] = '\0';
+    // NOTE: payload is not NUL-terminated, and must not be written past length.
 
     // Debug.print("MQTT RX: ");
-    // Debug.println((char*)payload);
+    // Debug.write(payload, length);
+    // Debug.println();
 
-    String topic_s(topic);
-    String payload_s((char*)payload);
-    HAComponent<Component::Switch>::processMqttTopic(topic_s, payload_s);
+    if (s_config_syncing && processRetainedConfig(topic, payload, length)) {
+        return;
+    }
+
+    if (s_rediscover_on_birth && strcmp(topic, HA_STATUS_TOPIC) == 0) {
+        if (payloadEquals(payload, length, "online")) {
+            // HA (re)started and may have lost our configs, republish after a random delay
+            s_rediscover_at = millis() + ((HA_REDISCOVERY_JITTER_MS > 0) ? random(HA_REDISCOVERY_JITTER_MS) : 0);
+            s_rediscover_pending = true;
+        }
+        return;
+    }
+
+    HAComponent<Component::Switch>::processMqttTopic(topic, payload, length);
 }
 
 bool HAComponentManager::connectClientWithAvailability(PubSubClient& client, const char* id, const char* user, const char* password) {
-    HAAvailabilityComponent* avail = HAAvailabilityComponent::inst;
+    HAPubSubTransport transport(&client);
+    return connectWithWill(transport, HAAvailabilityComponent::inst, id, user, password);
+}
+
+bool HAComponentManager::connectClientWithAvailability(ComponentContext& context, const char* id, const char* user, const char* password) {
+    if (!connectWithWill(context.transport, context.availability, id, user, password)) {
+        return false;
+    }
+
+    // Other devices bridged over the same connection are available too,
+    // until the broker publishes this context's will
+    bool changed = (context.gateway != nullptr);
+    context.gateway = nullptr;
+    for (auto other = s_contexts; other != nullptr; other = other->m_next) {
+        if (other == &context || other->transport.getConnection() != context.transport.getConnection()) {
+            continue;
+        }
+        changed |= (other->gateway != &context);
+        other->gateway = &context;
+        if (other->availability != nullptr) {
+            other->availability->connect();
+        }
+    }
+
+#if HA_CONFIG_CACHE_SIZE > 0
+    if (changed) {
+        // Cached configs don't list the gateway's availability topic yet
+        buildConfigCache();
+    }
+#endif
+    return true;
+}
+
+bool HAComponentManager::connectWithWill(HATransport& transport, HAAvailabilityComponent* avail, const char* id, const char* user, const char* password) {
     if (avail != nullptr) {
-        String will_topic 		= avail->getWillTopic();
+        const char* will_topic 	= avail->getWillTopic();
         const char* will_msg 	= HAAvailabilityComponent::OFFLINE;
-        uint8_t will_qos 		= 0;
-        bool will_retain 		= true;
 
-        bool connected = client.connect(
+        bool connected = transport.connect(
             id, user, password,
-            will_topic.c_str(), will_qos, will_retain, will_msg
+            will_topic, will_msg
         );
 
         if (connected) {
+            // New session, republish states even if unchanged
+            HACompItem::m_connect_epoch++;
+            if (s_rediscover_on_birth) {
+                transport.subscribe(HA_STATUS_TOPIC);
+            }
+
             // Report alive status to availability topic
             avail->connect();
         }
         return connected;
     }
     else {
-        return client.connect(
-            id, user, password
-        );
+        if (transport.connect(id, user, password)) {
+            HACompItem::m_connect_epoch++;
+            if (s_rediscover_on_birth) {
+                transport.subscribe(HA_STATUS_TOPIC);
+            }
+            return true;
+        }
     }
     return false;
 }
 
-static void getDeviceInfo(JsonObject& json, ComponentContext& context) {
-    auto& deviceInfo = json.createNestedObject("device");
+void HAEventQueue::enable() {
+    if (!m_enabled) {
+        m_enabled = true;
+        m_next = s_queues;
+        s_queues = this;
+    }
+}
 
-    deviceInfo["identifiers"]   = context.mac_address;
-    deviceInfo["name"]          = context.friendly_name;
-    deviceInfo["sw_version"]    = context.fw_version;
-    deviceInfo["model"]         = context.model;
-    deviceInfo["manufacturer"]  = context.manufacturer;
+// Producer: only touches m_head, m_pushed and m_overflow_state.
+void IRAM_ATTR HAEventQueue::push(bool state) {
+    if (state == m_pushed) {
+        // Not an edge
+        return;
+    }
+    m_pushed = state;
 
-    // This tells HA if the component is available (connected) or not.
-    if (HAAvailabilityComponent::inst != nullptr) {
-        // NOTE: This doesn't seem to have any effect as long as you make sure the availability
-        // sensor is published with the same device information as other sensors...
-        //json["availability_topic"] = HAAvailabilityComponent::inst->getWillTopic();
+    uint8_t head = m_head.load(std::memory_order_relaxed);
+    uint8_t tail = m_tail.load(std::memory_order_acquire);
+    if ((uint8_t)(head - tail) >= HA_EVENT_QUEUE_SIZE) {
+        m_overflow_state.store(state, std::memory_order_release);
+        m_overflows.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
+
+    m_events[head & (HA_EVENT_QUEUE_SIZE - 1)] = state;
+    // Newer than any state lost to an overflow
+    m_overflow_state.store(-1, std::memory_order_relaxed);
+    m_head.store(head + 1, std::memory_order_release);
 }
 
-template<Component c>
-void HACompBase<c>::getConfigInfo(JsonObject& json)
-{
+// Consumer: hands each queued edge to the owning component, in order
+void HAEventQueue::drain() {
+    uint8_t tail = m_tail.load(std::memory_order_relaxed);
+    uint8_t head = m_head.load(std::memory_order_acquire);
+    while (tail != head) {
+        bool state = m_events[tail & (HA_EVENT_QUEUE_SIZE - 1)];
+        m_tail.store(++tail, std::memory_order_release);
+        if (state != m_drained) {
+            m_drained = state;
+            m_owner->onEvent(state);
+        }
+    }
+
+    // Catch up with the latest state if edges were dropped
+    int8_t latest = m_overflow_state.exchange(-1, std::memory_order_acquire);
+    if (latest >= 0 && latest != m_drained) {
+        m_drained = latest;
+        m_owner->onEvent(latest);
+    }
 }
 
-template<Component c>
-void HACompBase<c>::initialize()
-{
-    char state_topic[TOPIC_BUFFER_SIZE];
-    snprintf(state_topic, sizeof(state_topic), 
-        "%s/%s/%s/state\0", 
-        context.device_name, m_component, m_id);
-    m_state_topic = String(state_topic);
+void HAEventQueue::drainAll() {
+    for (auto queue = s_queues; queue != nullptr; queue = queue->m_next) {
+        queue->drain();
+    }
 }
 
-// Generic publish implementation used for all component types
-template<Component c>
-void HACompBase<c>::publishConfig(bool present)
-{
-    // Generic implementation
+bool HAPubSubTransport::connected() {
+    return m_client->connected();
+}
+
+bool HAPubSubTransport::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+    return m_client->publish(topic, payload, length, retain);
+}
+
+bool HAPubSubTransport::beginPublish(const char* topic, unsigned int length, bool retain) {
+    return m_client->beginPublish(topic, length, retain);
+}
+
+bool HAPubSubTransport::endPublish() {
+    return m_client->endPublish();
+}
+
+bool HAPubSubTransport::subscribe(const char* topic) {
+    return m_client->subscribe(topic);
+}
+
+bool HAPubSubTransport::unsubscribe(const char* topic) {
+    return m_client->unsubscribe(topic);
+}
+
+bool HAPubSubTransport::connect(const char* id, const char* user, const char* password,
+                                const char* will_topic, const char* will_message) {
+    if (will_topic != nullptr) {
+        // Will is always retained, QoS 0
+        return m_client->connect(id, user, password, will_topic, 0, true, will_message);
+    }
+    return m_client->connect(id, user, password);
+}
+
+size_t HAPubSubTransport::write(uint8_t c) {
+    return m_client->write(c);
+}
+
+size_t HAPubSubTransport::write(const uint8_t* buffer, size_t size) {
+    return m_client->write(buffer, size);
+}
+
+// Queue entries: [retain:1][topic length:2][payload length:2][topic][payload]
+#define HA_QUEUE_HEADER_SIZE (5)
+
+void HAQueuedTransport::put(size_t& pos, uint8_t c) {
+    m_queue[pos] = c;
+    pos = (pos + 1) % HA_TRANSPORT_QUEUE_SIZE;
+}
+
+uint8_t HAQueuedTransport::get(size_t& pos) const {
+    uint8_t c = m_queue[pos];
+    pos = (pos + 1) % HA_TRANSPORT_QUEUE_SIZE;
+    return c;
+}
+
+bool HAQueuedTransport::beginPublish(const char* topic, unsigned int length, bool retain) {
+    size_t topic_len = strlen(topic);
+    size_t size = HA_QUEUE_HEADER_SIZE + topic_len + length;
+    if (m_writing || topic_len >= TOPIC_BUFFER_SIZE || size > HA_TRANSPORT_QUEUE_SIZE - m_used) {
+        m_dropped++;
+        return false;
+    }
+
+    m_write = m_tail;
+    put(m_write, retain ? 1 : 0);
+    put(m_write, topic_len >> 8);
+    put(m_write, topic_len & 0xFF);
+    put(m_write, length >> 8);
+    put(m_write, length & 0xFF);
+    for (size_t i = 0; i < topic_len; i++) {
+        put(m_write, topic[i]);
+    }
+    m_size = size;
+    m_remaining = length;
+    m_writing = true;
+    return true;
+}
+
+size_t HAQueuedTransport::write(uint8_t c) {
+    if (!m_writing || m_remaining == 0) {
+        return 0;
+    }
+    put(m_write, c);
+    m_remaining--;
+    return 1;
+}
+
+bool HAQueuedTransport::endPublish() {
+    if (!m_writing) {
+        return false;
+    }
+    m_writing = false;
+    if (m_remaining != 0) {
+        // Short payload, discard the message
+        m_dropped++;
+        return false;
+    }
+
+    // Commit the message
+    m_tail = m_write;
+    m_used += m_size;
+    m_count++;
+    return true;
+}
+
+bool HAQueuedTransport::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+    if (!beginPublish(topic, length, retain)) {
+        return false;
+    }
+    write(payload, length);
+    return endPublish();
+}
+
+// Hand queued messages to the underlying transport, oldest first.
+// Stops at the first one it doesn't accept, which is retried next time.
+void HAQueuedTransport::loop() {
     char topic[TOPIC_BUFFER_SIZE];
+    for (int n = 0; n < HA_TRANSPORT_DRAIN_BATCH && m_count > 0; n++) {
+        if (!m_transport.connected()) {
+            return;
+        }
 
-    snprintf(topic, sizeof(topic), 
-        "homeassistant/%s/%s/%s/config\0", 
-        m_component, context.device_name, m_id);
+        size_t pos = m_head;
+        bool retain = get(pos) != 0;
+        size_t topic_len = get(pos) << 8;
+        topic_len |= get(pos);
+        size_t length = get(pos) << 8;
+        length |= get(pos);
+        for (size_t i = 0; i < topic_len; i++) {
+            topic[i] = get(pos);
+        }
+        topic[topic_len] = '\0';
 
-    if (present) {
-        StaticJsonBuffer<JSON_BUFFER_SIZE> jsonBuffer;
-        JsonObject& json = jsonBuffer.createObject();
+        if (!m_transport.beginPublish(topic, length, retain)) {
+            return;
+        }
+        // Payload may wrap around the end of the queue
+        size_t first = length;
+        if (pos + first > HA_TRANSPORT_QUEUE_SIZE) {
+            first = HA_TRANSPORT_QUEUE_SIZE - pos;
+        }
+        m_transport.write(&m_queue[pos], first);
+        if (first < length) {
+            m_transport.write(m_queue, length - first);
+        }
+        if (!m_transport.endPublish()) {
+            return;
+        }
 
-        //Led::SetBuiltin(true);
+        m_head = (pos + length) % HA_TRANSPORT_QUEUE_SIZE;
+        m_used -= HA_QUEUE_HEADER_SIZE + topic_len + length;
+        m_count--;
+    }
+}
+
+bool HALoopbackTransport::connect(const char* id, const char* user, const char* password,
+                                  const char* will_topic, const char* will_message) {
+    m_connected = true;
+    return true;
+}
+
+bool HALoopbackTransport::beginPublish(const char* topic, unsigned int length, bool retain) {
+    if (!m_connected || length > HA_LOOPBACK_BUFFER_SIZE || strlen(topic) >= sizeof(m_topic)) {
+        return false;
+    }
+    strcpy(m_topic, topic);
+    m_retain = retain;
+    m_expected = length;
+    m_length = 0;
+    m_writing = true;
+    return true;
+}
+
+size_t HALoopbackTransport::write(uint8_t c) {
+    if (!m_writing || m_length >= m_expected) {
+        return 0;
+    }
+    m_payload[m_length++] = c;
+    return 1;
+}
+
+bool HALoopbackTransport::endPublish() {
+    if (!m_writing) {
+        return false;
+    }
+    m_writing = false;
+    if (m_length != m_expected) {
+        return false;
+    }
+    m_payload[m_length] = '\0';
+    m_published++;
+    deliver();
+    return true;
+}
+
+bool HALoopbackTransport::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+    if (!beginPublish(topic, length, retain)) {
+        return false;
+    }
+    write(payload, length);
+    return endPublish();
+}
+
+bool HALoopbackTransport::subscribe(const char* topic) {
+    for (auto& sub : m_subscriptions) {
+        if (strcmp(sub.c_str(), topic) == 0) {
+            return true;
+        }
+    }
+    for (auto& sub : m_subscriptions) {
+        if (sub.length() == 0) {
+            sub = topic;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HALoopbackTransport::unsubscribe(const char* topic) {
+    for (auto& sub : m_subscriptions) {
+        if (strcmp(sub.c_str(), topic) == 0) {
+            sub = "";
+            return true;
+        }
+    }
+    return false;
+}
+
+// MQTT topic filter match, supporting single (+) and multi-level (#) wildcards
+bool HALoopbackTransport::topicMatches(const char* filter, const char* topic) {
+    while (*filter != '\0') {
+        if (*filter == '#') {
+            return true;
+        }
+        if (*filter == '+') {
+            while (*topic != '\0' && *topic != '/') {
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if (*filter != *topic) {
+            return false;
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == '\0';
+}
+
+void HALoopbackTransport::deliver() {
+    for (auto& sub : m_subscriptions) {
+        if (sub.length() > 0 && topicMatches(sub.c_str(), m_topic)) {
+            // The handler may publish again, which reuses these buffers
+            char topic[TOPIC_BUFFER_SIZE];
+            uint8_t payload[HA_LOOPBACK_BUFFER_SIZE + 1];
+            strcpy(topic, m_topic);
+            memcpy(payload, m_payload, m_length + 1);
+            HAComponentManager::onMessageReceived(topic, payload, m_length);
+            return;
+        }
+    }
+}
+
+static void getDeviceInfo(JsonObject& json, ComponentContext& context, const char* key = "device") {
+    auto& deviceInfo = json.createNestedObject(key);
+
+    deviceInfo["identifiers"]   = context.mac_address;
+    deviceInfo["name"]          = context.friendly_name;
+    deviceInfo["sw_version"]    = context.fw_version;
+    deviceInfo["model"]         = context.model;
+    deviceInfo["manufacturer"]  = context.manufacturer;
+
+    // This tells HA if the component is available (connected) or not.
+    if (context.availability != nullptr) {
+        // NOTE: This doesn't seem to have any effect as long as you make sure the availability
+        // sensor is published with the same device information as other sensors...
+        //json["availability_topic"] = context.availability->getWillTopic();
+    }
+
+    // A bridged device's own topic isn't any will, it is only offline with the gateway's
+    if (context.gateway != nullptr && context.gateway->availability != nullptr) {
+        auto& avty = json.createNestedArray("avty");
+        if (context.availability != nullptr) {
+            avty.createNestedObject()["t"] = context.availability->getWillTopic();
+        }
+        avty.createNestedObject()["t"] = context.gateway->availability->getWillTopic();
+        json["avty_mode"] = "all";
+    }
+}
+
+template<Component c>
+void HACompBase<c>::getConfigInfo(JsonObject& json)
+{
+}
+
+template<Component c>
+void HACompBase<c>::getConfigTopic(char* topic, size_t size)
+{
+    snprintf(topic, size,
+        HA_CONFIG_TOPIC("%s", "%s", "%s"),
+        m_component, context.device_name, m_id);
+}
+
+template<Component c>
+void HACompBase<c>::initialize()
+{
+    char state_topic[TOPIC_BUFFER_SIZE];
+    snprintf(state_topic, sizeof(state_topic),
+        HA_STATE_TOPIC("%s", "%s", "%s"),
+        context.device_name, m_component, m_id);
+    m_state_topic = state_topic;
+}
+
+template<Component c>
+void HACompBase<c>::buildConfig(JsonObject& json)
+{
+    json["name"]    = m_name;
+    json["stat_t"]  = m_state_topic.c_str();
+
+    // For a complete list of JSON parameters you can set, see:
+    // https://www.home-assistant.io/docs/mqtt/discovery/
+    getConfigInfo(json);
+
+    // Add unique ID for component
+    char uid[TOPIC_BUFFER_SIZE];
+    snprintf(uid, sizeof(uid),
+        HA_UNIQUE_ID("%s", "%s"),
+        context.device_name, m_id);
+    
+    json["unique_id"] = uid;
+    json["object_id"] = uid; // Used for generation of entity_id
+
+    //json["entity_category"] = "config"/"diagnostic";
+
+    if (m_icon != nullptr) {
+        // Optional icon for HA UI
+        // eg. "mdi:plug"
+        json["icon"] = m_icon;
+    }
+}
+
+#if HA_CONFIG_CACHE_SIZE > 0
+// Serialize each component's config once. Config options (precision, aggregation
+// etc.) must therefore be set before initializeAll().
+void HAComponentManager::buildConfigCache() {
+    s_config_cache_used = 0;
+    for (auto item = HACompItem::m_components; item != nullptr; item = item->m_next) {
+        item->m_config_cache = nullptr;
+
+        StaticJsonBuffer<JSON_BUFFER_SIZE> jsonBuffer;
+        JsonObject& json = jsonBuffer.createObject();
+        item->buildConfig(json);
+        getDeviceInfo(json, item->getContext());
+
+        size_t length = json.measureLength();
+        if (length > HA_CONFIG_CACHE_SIZE - s_config_cache_used || length > UINT16_MAX) {
+            Debug.print("Config cache full: ");
+            Debug.println(item->getId());
+            continue;
+        }
+
+        uint8_t* cache = &s_config_cache[s_config_cache_used];
+        BufferPrint out(cache, length);
+        json.printTo(out);
+        item->m_config_cache = cache;
+        item->m_config_cache_length = length;
+        item->m_config_cache_hash = hashString((const char*)cache, length);
+        s_config_cache_used += length;
+    }
+}
+
+bool HACompItem::publishCachedConfig(const char* topic) {
+    if (m_config_diff && m_retained && m_retained_hash == m_config_cache_hash) {
+        // Broker already holds this exact config
+        m_config_stats.skipped++;
+        onConfigPublished();
+        return true;
+    }
+
+    Debug.print("publish: ");
+    Debug.println(topic);
+
+    HATransport& transport = getContext().transport;
+    bool ok = transport.beginPublish(topic, m_config_cache_length, true);
+    if (ok) {
+        transport.write(m_config_cache, m_config_cache_length);
+        ok = transport.endPublish();
+    }
+    countPublish(ok, strlen(topic) + m_config_cache_length);
+    if (!ok) {
+        Debug.println("ERROR PUBLISHING TOPIC");
+        return false;
+    }
+
+    m_config_stats.published++;
+    m_retained_hash = m_config_cache_hash;
+    m_retained = m_config_diff;
+    onConfigPublished();
+    return true;
+}
+#endif
+
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+// JSON buffer that remembers a failed allocation. ArduinoJson drops members
+// it can't allocate without an error, leaving an incomplete config.
+class CheckedJsonBuffer : public StaticJsonBuffer<HA_DEVICE_JSON_BUFFER_SIZE> {
+public:
+    bool overflowed = false;
+
+    void* alloc(size_t bytes) override {
+        void* p = StaticJsonBuffer<HA_DEVICE_JSON_BUFFER_SIZE>::alloc(bytes);
+        overflowed |= (p == nullptr);
+        return p;
+    }
+};
+
+// Publish every component of one device in a single config message
+HAComponentManager::DeviceConfigResult HAComponentManager::publishDeviceConfig(ComponentContext& context, bool present) {
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic),
+        "homeassistant/device/%s/config",
+        context.device_name);
+
+    // Built even to unpublish: a device too large for a device config
+    // was discovered (and is removed) through per-component configs.
+    // Too large for the stack on most devices
+    static CheckedJsonBuffer jsonBuffer;
+    jsonBuffer.clear();
+    jsonBuffer.overflowed = false;
+    JsonObject& json = jsonBuffer.createObject();
+
+    getDeviceInfo(json, context, "dev");
+    auto& origin = json.createNestedObject("o");
+    origin["name"] = "hacomponent";
+
+    auto& components = json.createNestedObject("cmps");
+    for (auto item = context.m_components; item != nullptr; item = item->m_context_next) {
+        auto& cmp = components.createNestedObject(item->getId());
+        if (!cmp.success()) {
+            break;
+        }
+        cmp["p"] = item->getPlatform(); // "platform"
+        item->buildConfig(cmp);
+    }
+
+    if (jsonBuffer.overflowed) {
+        Debug.print("Device config too large: ");
+        Debug.println(topic);
+        return DeviceConfigResult::TooLarge;
+    }
+
+    if (!present) {
+        Debug.print("unpublish: ");
+        Debug.println(topic);
+
+        if (!context.transport.publish(topic, nullptr, 0, true)) {
+            return DeviceConfigResult::Failed;
+        }
+        for (auto item = context.m_components; item != nullptr; item = item->m_context_next) {
+            item->clearState();
+        }
+        return DeviceConfigResult::Published;
+    }
+
+    Debug.print("publish: ");
+    Debug.println(topic);
+
+    size_t length = json.measureLength();
+    bool ok = context.transport.beginPublish(topic, length, true);
+    if (ok) {
+        ChunkPrint out(context.transport);
+        json.printTo(out);
+        out.flush();
+        ok = context.transport.endPublish();
+    }
+    m_global_stats.countPublish(ok, strlen(topic) + length);
+    if (!ok) {
+        Debug.println("ERROR PUBLISHING TOPIC");
+        return DeviceConfigResult::Failed;
+    }
+
+    m_config_stats.published++;
+    for (auto item = context.m_components; item != nullptr; item = item->m_context_next) {
+        item->onConfigPublished();
+    }
+    return DeviceConfigResult::Published;
+}
+
+// Incremental device discovery: one config per device, or for a device too
+// large for that, its per-component configs (s_config_cursor walks them).
+bool HAComponentManager::serviceDeviceConfigs(unsigned int max_messages) {
+    while (s_device_cursor != nullptr && max_messages > 0) {
+        if (s_config_cursor == nullptr) {
+            switch (publishDeviceConfig(*s_device_cursor, s_config_present)) {
+                case DeviceConfigResult::Published:
+                    s_device_cursor = s_device_cursor->m_next;
+                    max_messages--;
+                    continue;
+                case DeviceConfigResult::TooLarge:
+                    s_config_cursor = s_device_cursor->m_components;
+                    break;
+                case DeviceConfigResult::Failed:
+                    return false;
+            }
+        }
+
+        while (s_config_cursor != nullptr && max_messages > 0) {
+            if (!s_config_cursor->publishConfig(s_config_present)) {
+                return false;
+            }
+            s_config_cursor = s_config_cursor->m_context_next;
+            max_messages--;
+        }
+        if (s_config_cursor == nullptr) {
+            s_device_cursor = s_device_cursor->m_next;
+        }
+    }
+    return (s_device_cursor == nullptr);
+}
+#endif
+
+// Generic publish implementation used for all component types
+template<Component c>
+bool HACompBase<c>::publishConfig(bool present)
+{
+    // Generic implementation
+    char topic[TOPIC_BUFFER_SIZE];
+    getConfigTopic(topic, sizeof(topic));
+
+#if HA_CONFIG_CACHE_SIZE > 0
+    if (present && m_config_cache != nullptr) {
+        return publishCachedConfig(topic);
+    }
+#endif
+
+    if (present) {
+        StaticJsonBuffer<JSON_BUFFER_SIZE> jsonBuffer;
+        JsonObject& json = jsonBuffer.createObject();
+
+        //Led::SetBuiltin(true);
+
+        buildConfig(json);
+
+        // Add device information
+        getDeviceInfo(json, context);
+
+        uint32_t hash = 0;
+        if (m_config_diff) {
+            HashPrint hasher;
+            json.printTo(hasher);
+            hash = hasher.hash;
+
+            if (m_retained && m_retained_hash == hash) {
+                // Broker already holds this exact config
+                m_config_stats.skipped++;
+                onConfigPublished();
+                return true;
+            }
+        }
+
+        Debug.print("publish: ");
+        Debug.print(topic);
+        if (!present) {
+            Debug.print(" (not present)");
+        } else {
+            //Debug.print(" -> ");
+            //Debug.print(payload.c_str());
+        }
+        Debug.println();
+
+        // Stream the payload directly into the client rather than
+        // serializing to an intermediate String and copying it into the
+        // PubSubClient buffer, a chunk at a time.
+        size_t length = json.measureLength();
+        bool ok = context.transport.beginPublish(topic, length, true);
+        if (ok) {
+            ChunkPrint out(context.transport);
+            json.printTo(out);
+            out.flush();
+            ok = context.transport.endPublish();
+        }
+        countPublish(ok, strlen(topic) + length);
+        if (!ok) {
+            Debug.println("ERROR PUBLISHING TOPIC");
+            return false;
+        }
+
+        m_config_stats.published++;
+        m_retained_hash = hash;
+        m_retained = m_config_diff;
+        onConfigPublished();
+        return true;
+    } 
+    else {
+        // If not present, we should unpublish the topic
+        Debug.print("unpublish: ");
+        Debug.println(topic);
+
+        // IMPORTANT: Use 4-arg overload. The 2 & 3-arg overloads try to call strlen() on payload
+        if (!context.transport.publish(topic, nullptr, 0, true)) {
+            return false;
+        }
+        m_retained = false;
+
+        // Also unpublish the parent node
+        snprintf(topic, sizeof(topic),
+            HA_CONFIG_NODE("%s", "%s", "%s"),
+            m_component, context.device_name, m_id);
+        context.transport.publish(topic, nullptr, 0, true);
+
+        // And finally clear the current state
+        // (so it's clear the last retained sensor value is no longer valid)
+        clearState();
+        return true;
+    }
+
+    //Led::SetBuiltin(false);
+}
+
+HAComponent<Component::Switch>::HAComponent(ComponentContext& context, const char* id, const char* name, HASwitchCallback callback, const char* icon) :
+    HACompBase(context, id, name),
+    m_state(false),
+    m_callback(callback),
+    m_cmd_hash(0),
+    m_hash_next(nullptr),
+    m_next_switch(m_switches),
+    m_events(this)
+{
+    m_icon = icon;
+    m_switches = this;
+    m_switch_count++;
+}
+
+void HAComponent<Component::Switch>::initialize()
+{
+    HACompBase<Component::Switch>::initialize();
+
+    char cmd_topic[TOPIC_BUFFER_SIZE];
+    snprintf(cmd_topic, sizeof(cmd_topic),
+        HA_COMMAND_TOPIC("%s", "%s"),
+        context.device_name, m_id);
+    m_cmd_topic = cmd_topic;
+    m_cmd_hash = hashString(m_cmd_topic.c_str(), m_cmd_topic.length());
+}
+
+// Topic specialization for switch components
+void HAComponent<Component::Switch>::getConfigInfo(JsonObject& json)
+{
+    // https://www.home-assistant.io/components/switch.mqtt/
+
+    json["cmd_t"]   = m_cmd_topic.c_str(); // "command_topic"
+}
+
+void HAComponent<Component::Switch>::onConfigPublished()
+{
+    context.transport.subscribe(m_cmd_topic.c_str());
+    reportState();
+}
+
+void IRAM_ATTR HAComponent<Component::Switch>::reportStateFromISR(bool state)
+{
+    m_events.push(state);
+}
+
+void HAComponent<Component::Switch>::onEvent(bool state)
+{
+    m_state = state;
+    reportState();
+}
+
+void HAComponent<Component::Switch>::setState(bool state)
+{
+    m_state = state;
+    m_callback(state);
+
+    reportState();
+}
+
+void HAComponent<Component::Switch>::reportState()
+{
+    publishState(m_state ? ON : OFF);
+}
+
+// Build a power-of-two sized hash table of command topics, so incoming
+// messages can be resolved without scanning every switch.
+void HAComponent<Component::Switch>::buildDispatchTable()
+{
+    size_t size = 1;
+    while (size < m_switch_count * 2) {
+        size <<= 1;
+    }
+
+#ifdef HA_NO_HEAP
+    if (size > HA_SWITCH_DISPATCH_SIZE) {
+        size = HA_SWITCH_DISPATCH_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        m_dispatch[i] = nullptr;
+    }
+#else
+    m_dispatch.assign(size, nullptr);
+#endif
+    m_dispatch_size = size;
+
+    for (auto* sw = m_switches; sw != nullptr; sw = sw->m_next_switch) {
+        auto& bucket = m_dispatch[sw->m_cmd_hash & (size - 1)];
+        sw->m_hash_next = bucket;
+        bucket = sw;
+    }
+}
+
+void HAComponent<Component::Switch>::processMqttTopic(const char* topic, const byte* payload, unsigned int length)
+{
+    // Only "<device>/switch/<id>/ctrl" topics are dispatched
+    static const char suffix[] = "/ctrl";
+    const size_t suffix_len = sizeof(suffix) - 1;
+    size_t topic_len = strlen(topic);
+    if (topic_len <= suffix_len || strcmp(topic + topic_len - suffix_len, suffix) != 0) {
+        return;
+    }
+    if (m_dispatch_size == 0) {
+        return;
+    }
+
+    uint32_t hash = hashString(topic, topic_len);
+    auto* sw = m_dispatch[hash & (m_dispatch_size - 1)];
+    for (; sw != nullptr; sw = sw->m_hash_next) {
+        //Debug.print("CHECK: "); Debug.println(sw->m_cmd_topic);
+        if (sw->m_cmd_hash == hash && strcmp(sw->m_cmd_topic.c_str(), topic) == 0) {
+            unsigned long start = micros();
+            if (payloadEquals(payload, length, ON)) {
+                sw->setState(true);
+            }
+            else if (payloadEquals(payload, length, OFF)) {
+                sw->setState(false);
+            }
+            else {
+                Debug.print("Invalid payload received for switch: ");
+                Debug.write(payload, length);
+                Debug.println();
+                break;
+            }
+
+            // Time from receiving the command to reporting the new state
+            recordLatency(micros() - start);
+            sw->m_stats.commands++;
+            m_global_stats.commands++;
+            break;
+        }
+    }
+}
+
+
+// Topic specialization for sensor components
+void HAComponent<Component::Sensor>::getConfigInfo(JsonObject& json)
+{
+    // https://www.home-assistant.io/components/sensor.mqtt/
+
+    // Update sensor state even if value hasn't changed.
+    // This ensures Graphite/Grafana get regularly spaced samples!
+    // Only wanted when every value is reported, or for max-silence heartbeats,
+    // otherwise repeated values are what the reporting policy is suppressing.
+    if (forceUpdate()) {
+        json["frc_upd"] = true; // "force_update"
+    }
+
+    // Device class and units from the (flash resident) table
+    const SensorClassInfo& info = s_sensor_classes[(size_t)m_sensor_class];
+    const char* device_class = (const char*)pgm_read_ptr(&info.device_class);
+    const char* units = (const char*)pgm_read_ptr(&info.units);
+
+    json["sug_dsp_prc"] = m_precision; // "suggested_display_precision"
+
+    if (m_group != nullptr) {
+        // Extract this sensor's value from the group's JSON state
+        char value_template[TOPIC_BUFFER_SIZE];
+        snprintf(value_template, sizeof(value_template),
+            "{{ value_json['%s'] }}", m_id);
+        json["val_tpl"] = value_template; // "value_template"
+    }
+    else if (m_sdt_tolerance > 0.f) {
+        // Swinging door points are published with their timestamp
+        json["val_tpl"] = "{{ value_json.val }}";
+        json["json_attr_t"] = m_state_topic.c_str(); // "json_attributes_topic"
+    }
+
+    json["unit_of_meas"] = FPSTR(units); // "unit_of_measurement"
+    if (device_class != nullptr) {
+        json["dev_cla"] = FPSTR(device_class);
+    }
+}
+
+// Generic publish implementation for sending sensor readings
+template<Component c>
+bool HACompBase<c>::publishState(const char* value, bool retain, bool force)
+{
+    //Led::SetBuiltin(true);
+
+    // Debug.print("publish: ");
+    // Debug.print(m_state_topic);
+    // Debug.print(" ");
+    // Debug.print("=");
+    // Debug.println(value);
+
+    size_t length = strlen(value);
+    uint32_t hash = hashString(value, length);
+    unsigned long now = millis();
+    if (!force && m_state_refresh > 0 &&
+        m_state_epoch == m_connect_epoch && m_state_hash == hash &&
+        now - m_state_ts < m_state_refresh) {
+        // Already published
+        m_stats.suppressed++;
+        m_global_stats.suppressed++;
+        return true;
+    }
+
+    bool ok = context.transport.publish(m_state_topic.c_str(), value, retain);
+    countPublish(ok, m_state_topic.length() + length);
+    if (ok) {
+        m_state_hash = hash;
+        m_state_epoch = m_connect_epoch;
+        m_state_ts = now;
+    }
+    return ok;
+
+    //Led::SetBuiltin(false);
+}
+
+template<Component c>
+void HACompBase<c>::clearState()
+{
+    // Un-publish the state topic
+    // IMPORTANT: Use 4-arg overload. The 2 & 3-arg overloads try to call strlen() on payload
+    context.transport.publish(m_state_topic.c_str(), nullptr, 0, true);
+    m_state_epoch = 0;
+}
+
+// Format a float with a fixed number of decimal places (max 6) into buf.
+// Uses integer arithmetic and no allocations. Values too large to scale into
+// 32 bits are written with 9 significant digits (exponent notation) instead.
+static void formatFloat(char* buf, size_t size, float value, uint8_t precision)
+{
+    static const uint32_t scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    const uint32_t scale = scales[precision];
+
+    float scaled_f = fabsf(value) * (float)scale + 0.5f;
+    if (!(scaled_f < 4294967040.f)) {
+        snprintf(buf, size, "%.9g", (double)value);
+        return;
+    }
+
+    uint32_t scaled = (uint32_t)scaled_f;
+    uint32_t int_part = scaled / scale;
+    uint32_t frac_part = scaled % scale;
+
+    // Build the string backwards from the end of a local buffer
+    // (at most sign, 10 digits, point and 6 decimals)
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    *--p = '\0';
+    for (uint8_t i = 0; i < precision; i++) {
+        *--p = '0' + (frac_part % 10);
+        frac_part /= 10;
+    }
+    if (precision > 0) {
+        *--p = '.';
+    }
+    do {
+        *--p = '0' + (int_part % 10);
+        int_part /= 10;
+    } while (int_part > 0);
+    if (value < 0.f && scaled > 0) {
+        *--p = '-';
+    }
+
+    snprintf(buf, size, "%s", p);
+}
+
+void HAComponent<Component::Sensor>::setAggregation(SensorAggregation mode, float param)
+{
+    m_aggregation = mode;
+    m_samples = 0;
+    m_sum = 0.f;
+    m_sum_sq = 0.f;
+#ifdef HA_SENSOR_EMA
+    m_ema_alpha = param;
+    m_ema_valid = false;
+#endif
+#ifdef HA_SENSOR_PERCENTILE
+    m_quantile.reset(param);
+#endif
+}
+
+// Add a sample to the current window, O(1) for every mode
+void HAComponent<Component::Sensor>::accumulate(float value)
+{
+#ifdef HA_SENSOR_CONCURRENT
+    if (m_aggregation <= SensorAggregation::Last) {
+        m_window.add(value);
+        return;
+    }
+    HASpinLock lock(m_lock);
+#endif
+
+    if (m_samples == 0 || value < m_min) {
+        m_min = value;
+    }
+    if (m_samples == 0 || value > m_max) {
+        m_max = value;
+    }
+    m_last = value;
+    m_samples++;
+    m_sum += value;
+    m_sum_sq += value * value;
+
+    switch (m_aggregation) {
+#ifdef HA_SENSOR_EMA
+        case SensorAggregation::EMA:
+            m_ema = m_ema_valid ? (m_ema + m_ema_alpha * (value - m_ema)) : value;
+            m_ema_valid = true;
+            break;
+#endif
+#ifdef HA_SENSOR_PERCENTILE
+        case SensorAggregation::Percentile:
+            m_quantile.add(value);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+// Compute the value for the current window and start a new one.
+// Returns false if there were no samples in the window.
+bool HAComponent<Component::Sensor>::aggregate(float& value)
+{
+#ifdef HA_SENSOR_CONCURRENT
+    if (m_aggregation <= SensorAggregation::Last) {
+        return m_window.take(m_aggregation, value);
+    }
+    HASpinLock lock(m_lock);
+#endif
+
+    if (m_samples == 0) {
+        return false;
+    }
+
+    switch (m_aggregation) {
+        case SensorAggregation::Min:        value = m_min; break;
+        case SensorAggregation::Max:        value = m_max; break;
+        case SensorAggregation::Last:       value = m_last; break;
+#ifdef HA_SENSOR_EMA
+        case SensorAggregation::EMA:        value = m_ema; break;
+#endif
+#ifdef HA_SENSOR_PERCENTILE
+        case SensorAggregation::Percentile:
+            value = m_quantile.get();
+            m_quantile.reset();
+            break;
+#endif
+        case SensorAggregation::Mean:
+        default:
+            value = m_sum / (float)m_samples;
+            break;
+        case SensorAggregation::RMS:
+            value = sqrtf(m_sum_sq / (float)m_samples);
+            break;
+    }
+
+    m_samples = 0;
+    m_sum = 0.f;
+    m_sum_sq = 0.f;
+    return true;
+}
+
+// EMA and Percentile need every sample, in order, rather than a batch summary
+bool HAComponent<Component::Sensor>::isSequential() const
+{
+#ifdef HA_SENSOR_EMA
+    if (m_aggregation == SensorAggregation::EMA) {
+        return true;
+    }
+#endif
+#ifdef HA_SENSOR_PERCENTILE
+    if (m_aggregation == SensorAggregation::Percentile) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+// Merge a batch summary into the current window (not for EMA or Percentile,
+// which need every sample)
+void HAComponent<Component::Sensor>::accumulate(const HASampleStats& stats)
+{
+    if (stats.samples == 0) {
+        return;
+    }
+
+#ifdef HA_SENSOR_CONCURRENT
+    if (m_aggregation <= SensorAggregation::Last) {
+        m_window.add(stats);
+        return;
+    }
+    HASpinLock lock(m_lock);
+#endif
+
+    if (m_samples == 0 || stats.min < m_min) {
+        m_min = stats.min;
+    }
+    if (m_samples == 0 || stats.max > m_max) {
+        m_max = stats.max;
+    }
+    m_last = stats.last;
+    m_samples += stats.samples;
+    m_sum += stats.sum;
+    m_sum_sq += stats.sum_sq;
+}
+
+// Summarize a batch of samples. Each of HA_BLOCK_LANES lanes accumulates
+// independently with branch-free selects, so the compiler can vectorize the
+// inner loop; non-finite values are masked out (x - x is NaN for NaN/Inf).
+#define HA_BLOCK_LANES (8)
+
+template<typename T, typename Convert>
+static HASampleStats blockStats(const T* samples, size_t count, Convert convert)
+{
+    float sum[HA_BLOCK_LANES] = { };
+    float sum_sq[HA_BLOCK_LANES] = { };
+    float min[HA_BLOCK_LANES];
+    float max[HA_BLOCK_LANES];
+    uint32_t valid[HA_BLOCK_LANES] = { };
+    for (int j = 0; j < HA_BLOCK_LANES; j++) {
+        min[j] = INFINITY;
+        max[j] = -INFINITY;
+    }
+
+    size_t i = 0;
+    for (; i + HA_BLOCK_LANES <= count; i += HA_BLOCK_LANES) {
+        for (int j = 0; j < HA_BLOCK_LANES; j++) {
+            float x = convert(samples[i + j]);
+            bool finite = (x - x) == 0.f;
+            float v = finite ? x : 0.f;
+            sum[j] += v;
+            sum_sq[j] += v * v;
+            min[j] = (finite && x < min[j]) ? x : min[j];
+            max[j] = (finite && x > max[j]) ? x : max[j];
+            valid[j] += finite;
+        }
+    }
+    for (int j = 0; i < count; i++, j++) {
+        float x = convert(samples[i]);
+        if ((x - x) == 0.f) {
+            sum[j] += x;
+            sum_sq[j] += x * x;
+            min[j] = (x < min[j]) ? x : min[j];
+            max[j] = (x > max[j]) ? x : max[j];
+            valid[j]++;
+        }
+    }
 
-        json["name"]    = m_name;
-        json["stat_t"]  = m_state_topic;
+    HASampleStats stats = { 0.f, 0.f, INFINITY, -INFINITY, 0.f, 0 };
+    for (int j = 0; j < HA_BLOCK_LANES; j++) {
+        stats.sum += sum[j];
+        stats.sum_sq += sum_sq[j];
+        stats.min = (min[j] < stats.min) ? min[j] : stats.min;
+        stats.max = (max[j] > stats.max) ? max[j] : stats.max;
+        stats.samples += valid[j];
+    }
 
-        // For a complete list of JSON parameters you can set, see:
-        // https://www.home-assistant.io/docs/mqtt/discovery/
-        getConfigInfo(json);
+    // Most recent finite sample
+    for (size_t k = count; k > 0; k--) {
+        float x = convert(samples[k - 1]);
+        if ((x - x) == 0.f) {
+            stats.last = x;
+            break;
+        }
+    }
+    return stats;
+}
 
-        // Add unique ID for component
-        char uid[TOPIC_BUFFER_SIZE];
-        snprintf(uid, sizeof(uid),
-            "%s_%s\0",
-            context.device_name, m_id);
-        
-        json["unique_id"] = uid;
-        json["object_id"] = uid; // Used for generation of entity_id
+#ifdef HA_SENSOR_CONCURRENT
+HAConcurrentWindow::HAConcurrentWindow()
+    : m_active(0)
+{
+    for (auto& bank : m_banks) {
+        reset(bank);
+        bank.writers = 0;
+    }
+}
 
-        //json["entity_category"] = "config"/"diagnostic";
+void HAConcurrentWindow::reset(Bank& bank)
+{
+    bank.sum.store(0.f, std::memory_order_relaxed);
+    bank.min.store(INFINITY, std::memory_order_relaxed);
+    bank.max.store(-INFINITY, std::memory_order_relaxed);
+    bank.samples.store(0, std::memory_order_relaxed);
+}
 
-        if (m_icon != nullptr) {
-            // Optional icon for HA UI
-            // eg. "mdi:plug"
-            json["icon"] = m_icon;
+void HAConcurrentWindow::add(const HASampleStats& stats)
+{
+    // Register as a writer of the active bank, retrying if it was switched meanwhile.
+    // Sequentially consistent, paired with take(): either take() sees this writer,
+    // or this writer sees the switch.
+    Bank* bank;
+    for (;;) {
+        uint8_t active = m_active.load(std::memory_order_seq_cst);
+        bank = &m_banks[active];
+        bank->writers.fetch_add(1, std::memory_order_seq_cst);
+        if (m_active.load(std::memory_order_seq_cst) == active) {
+            break;
         }
+        bank->writers.fetch_sub(1, std::memory_order_relaxed);
+    }
 
-        // Add device information
-        getDeviceInfo(json, context);
+    float current = bank->sum.load(std::memory_order_relaxed);
+    while (!bank->sum.compare_exchange_weak(current, current + stats.sum, std::memory_order_relaxed)) { }
+    current = bank->min.load(std::memory_order_relaxed);
+    while (stats.min < current && !bank->min.compare_exchange_weak(current, stats.min, std::memory_order_relaxed)) { }
+    current = bank->max.load(std::memory_order_relaxed);
+    while (stats.max > current && !bank->max.compare_exchange_weak(current, stats.max, std::memory_order_relaxed)) { }
+    bank->last.store(stats.last, std::memory_order_relaxed);
+    bank->samples.fetch_add(stats.samples, std::memory_order_relaxed);
 
-        String payload;
-        json.printTo(payload);
+    bank->writers.fetch_sub(1, std::memory_order_release);
+}
 
-        Debug.print("publish: ");
-        Debug.print(topic);
-        if (!present) {
-            Debug.print(" (not present)");
-        } else {
-            //Debug.print(" -> ");
-            //Debug.print(payload.c_str());
+bool HAConcurrentWindow::take(SensorAggregation mode, float& value, uint32_t* count)
+{
+    uint8_t active = m_active.load(std::memory_order_relaxed);
+    Bank& bank = m_banks[active];
+    m_active.store(active ^ 1, std::memory_order_seq_cst);
+
+    // Writers only stay registered for a few instructions. This load must not
+    // be ordered before the switch above (an acquire load could be), or a writer
+    // registering meanwhile would be missed. Yield in case one was preempted.
+    for (uint32_t spins = 1; bank.writers.load(std::memory_order_seq_cst) != 0; spins++) {
+        if (spins % HA_SPIN_YIELD_ITERATIONS == 0) {
+            yield();
         }
-        Debug.println();
+    }
 
-        if (!context.client.publish(topic, payload.c_str(), true)) {
-            Debug.println("ERROR PUBLISHING TOPIC");
+    uint32_t samples = bank.samples.load(std::memory_order_relaxed);
+    if (samples > 0) {
+        switch (mode) {
+            case SensorAggregation::Min:    value = bank.min.load(std::memory_order_relaxed); break;
+            case SensorAggregation::Max:    value = bank.max.load(std::memory_order_relaxed); break;
+            case SensorAggregation::Last:   value = bank.last.load(std::memory_order_relaxed); break;
+            case SensorAggregation::Mean:
+            default:
+                value = bank.sum.load(std::memory_order_relaxed) / (float)samples;
+                break;
         }
-    } 
-    else {
-        // If not present, we should unpublish the topic
-        Debug.print("unpublish: ");
-        Debug.println(topic);
+    }
+    reset(bank);
+    if (count != nullptr) {
+        *count = samples;
+    }
+    return samples > 0;
+}
+#endif
 
-        // IMPORTANT: Use 4-arg overload. The 2 & 3-arg overloads try to call strlen() on payload
-        context.client.publish(topic, nullptr, 0, true);
+#ifdef HA_SENSOR_PERCENTILE
+void HAQuantileEstimator::reset(float p)
+{
+    m_p = p;
+    m_count = 0;
+}
 
-        // Also unpublish the parent node
-        snprintf(topic, sizeof(topic), 
-            "homeassistant/%s/%s/%s\0", 
-            m_component, context.device_name, m_id);
-        context.client.publish(topic, nullptr, 0, true);
+void HAQuantileEstimator::add(float x)
+{
+    if (m_count < 5) {
+        // Collect the first five samples, then initialize the markers
+        m_q[m_count++] = x;
+        if (m_count == 5) {
+            for (int i = 1; i < 5; i++) {
+                for (int j = i; j > 0 && m_q[j - 1] > m_q[j]; j--) {
+                    float t = m_q[j]; m_q[j] = m_q[j - 1]; m_q[j - 1] = t;
+                }
+            }
+            for (int i = 0; i < 5; i++) {
+                m_n[i] = (float)i;
+            }
+            m_np[0] = 0.f;          m_dn[0] = 0.f;
+            m_np[1] = 2.f * m_p;    m_dn[1] = m_p / 2.f;
+            m_np[2] = 4.f * m_p;    m_dn[2] = m_p;
+            m_np[3] = 2.f + 2.f * m_p; m_dn[3] = (1.f + m_p) / 2.f;
+            m_np[4] = 4.f;          m_dn[4] = 1.f;
+        }
+        return;
+    }
+    m_count++;
+
+    // Find the cell containing x, extending the extremes if needed
+    int k;
+    if (x < m_q[0]) {
+        m_q[0] = x;
+        k = 0;
+    } else if (x >= m_q[4]) {
+        m_q[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; k < 3 && x >= m_q[k + 1]; k++) { }
+    }
 
-        // And finally clear the current state
-        // (so it's clear the last retained sensor value is no longer valid)
-        clearState();
+    for (int i = k + 1; i < 5; i++) {
+        m_n[i] += 1.f;
+    }
+    for (int i = 0; i < 5; i++) {
+        m_np[i] += m_dn[i];
     }
 
-    //Led::SetBuiltin(false);
+    // Adjust the middle markers towards their desired positions
+    for (int i = 1; i < 4; i++) {
+        float d = m_np[i] - m_n[i];
+        if ((d >= 1.f && m_n[i + 1] - m_n[i] > 1.f) || (d <= -1.f && m_n[i - 1] - m_n[i] < -1.f)) {
+            float ds = (d >= 0.f) ? 1.f : -1.f;
+
+            // Piecewise-parabolic prediction
+            float q = m_q[i] + ds / (m_n[i + 1] - m_n[i - 1]) * (
+                (m_n[i] - m_n[i - 1] + ds) * (m_q[i + 1] - m_q[i]) / (m_n[i + 1] - m_n[i]) +
+                (m_n[i + 1] - m_n[i] - ds) * (m_q[i] - m_q[i - 1]) / (m_n[i] - m_n[i - 1]));
+
+            if (m_q[i - 1] < q && q < m_q[i + 1]) {
+                m_q[i] = q;
+            } else {
+                // Fall back to linear prediction
+                int j = i + (int)ds;
+                m_q[i] += ds * (m_q[j] - m_q[i]) / (m_n[j] - m_n[i]);
+            }
+            m_n[i] += ds;
+        }
+    }
 }
 
-HAComponent<Component::Switch>::HAComponent(ComponentContext& context, const char* id, const char* name, std::function<void(boolean)> callback, const char* icon) :
-    HACompBase(context, id, name),
-    m_callback(callback),
-    m_state(false)
+float HAQuantileEstimator::get() const
 {
-    m_icon = icon;
-    HAComponent<Component::Switch>::m_switches.push_back(this);
+    if (m_count >= 5) {
+        return m_q[2];
+    }
+    if (m_count == 0) {
+        return NAN;
+    }
+
+    // Too few samples for the markers, pick directly from a sorted copy
+    float sorted[5];
+    for (uint32_t i = 0; i < m_count; i++) {
+        sorted[i] = m_q[i];
+        for (uint32_t j = i; j > 0 && sorted[j - 1] > sorted[j]; j--) {
+            float t = sorted[j]; sorted[j] = sorted[j - 1]; sorted[j - 1] = t;
+        }
+    }
+    return sorted[(uint32_t)(m_p * (m_count - 1) + 0.5f)];
 }
+#endif
 
-void HAComponent<Component::Switch>::initialize()
+// Sensor reading publish implementation
+void HAComponent<Component::Sensor>::update(float value)
 {
-    HACompBase<Component::Switch>::initialize();
+    // Ensure value is not NaN or Infinity
+    if (!std::isfinite(value)) {
+        return;
+    }
 
-    char cmd_topic[TOPIC_BUFFER_SIZE];
-    snprintf(cmd_topic, sizeof(cmd_topic), 
-        "%s/%s/%s/ctrl\0", 
-        context.device_name, m_component, m_id);
-    m_cmd_topic = String(cmd_topic);
+    accumulate(value);
+    poll();
 }
 
-// Topic specialization for switch components
-void HAComponent<Component::Switch>::getConfigInfo(JsonObject& json)
+void HAComponent<Component::Sensor>::update(const float* samples, size_t count)
 {
-    // https://www.home-assistant.io/components/switch.mqtt/
+    if (isSequential()) {
+        for (size_t i = 0; i < count; i++) {
+            if (std::isfinite(samples[i])) {
+                accumulate(samples[i]);
+            }
+        }
+    } else {
+        accumulate(blockStats(samples, count, [](float x) { return x; }));
+    }
+    poll();
+}
 
-    json["cmd_t"]   = m_cmd_topic; // "command_topic"
+void HAComponent<Component::Sensor>::update(const int16_t* samples, size_t count, float scale, float offset)
+{
+    auto convert = [scale, offset](int16_t raw) { return (float)raw * scale + offset; };
+    if (isSequential()) {
+        for (size_t i = 0; i < count; i++) {
+            accumulate(convert(samples[i]));
+        }
+    } else {
+        accumulate(blockStats(samples, count, convert));
+    }
+    poll();
+}
 
-    context.client.subscribe(m_cmd_topic.c_str());
+// Check the report interval after adding samples
+void HAComponent<Component::Sensor>::poll()
+{
+#ifndef HA_SENSOR_CONCURRENT
+    // Report from here only until the manager's scheduler takes over
+    if (!HAComponentManager::isScheduling()) {
+        unsigned long ts = millis();
+        if (m_timer.due(ts)) {
+            m_timer.advance(ts);
+            flush(ts);
+            if (m_group != nullptr && m_group->m_dirty) {
+                m_group->flush();
+            }
+        }
+    }
+#endif
+}
 
-    reportState();
+void HAComponent<Component::Sensor>::setGroup(HASensorGroup& group)
+{
+    m_group = &group;
+    group.add(this);
 }
 
-void HAComponent<Component::Switch>::setState(bool state)
+void HAComponent<Component::Sensor>::initialize()
 {
-    m_state = state;
-    m_callback(state);
+    HACompBase<Component::Sensor>::initialize();
+    if (m_group != nullptr) {
+        m_state_topic = m_group->m_state_topic.c_str();
+    }
 
-    reportState();
+    HAComponentManager::schedule(m_timer);
 }
 
-void HAComponent<Component::Switch>::reportState()
+void HAComponent<Component::Sensor>::onTimer(unsigned long now)
 {
-    context.client.publish(m_state_topic.c_str(), (m_state ? ON : OFF), true);
+    flush(now);
 }
 
-void HAComponent<Component::Switch>::processMqttTopic(String& topic, String& value)
+// Apply the reporting policy to a new window value. May replace value and
+// its timestamp ts with an earlier point to report instead.
+bool HAComponent<Component::Sensor>::shouldReport(float& value, unsigned long& ts, unsigned long now)
 {
-    for (auto* sw : m_switches) {
-        //Debug.print("CHECK: "); Debug.println(sw->m_cmd_topic);
-        if (sw->m_cmd_topic == topic) {
-            if (value.equalsIgnoreCase(ON)) {
-                sw->setState(true);
-            }
-            else if (value.equalsIgnoreCase(OFF)) {
-                sw->setState(false);
-            }
-            else {
-                Debug.print("Invalid payload received for switch: ");
-                Debug.println(value);
-            }
+    if (!m_reported || (m_max_silence > 0 && now - m_last_report_ts >= m_max_silence)) {
+        // Reported as is, the door restarts from here
+        m_sdt_value = value;
+        m_sdt_ts = now;
+        m_sdt_open = false;
+        return true;
+    }
 
-            break;
-        }
+    if (m_sdt_tolerance > 0.f) {
+        return swingDoor(value, ts, now);
     }
-}
 
+    float deadband = m_deadband_percent ? (fabsf(m_last_value) * m_deadband / 100.f) : m_deadband;
+    return (deadband == 0.f) || (fabsf(value - m_last_value) >= deadband);
+}
 
-// Topic specialization for sensor components
-void HAComponent<Component::Sensor>::getConfigInfo(JsonObject& json)
+// Swinging door: narrow the range of slopes from the pivot (last archived
+// point) that keep every value since within tolerance. Once the door closes
+// the previous point is archived, and the door reopens from it.
+bool HAComponent<Component::Sensor>::swingDoor(float& value, unsigned long& ts, unsigned long now)
 {
-    // https://www.home-assistant.io/components/sensor.mqtt/
+    float dt = (float)(now - m_sdt_ts);
+    if (dt <= 0.f) {
+        return false;
+    }
+    float upper = (value + m_sdt_tolerance - m_sdt_value) / dt;
+    float lower = (value - m_sdt_tolerance - m_sdt_value) / dt;
+    if (m_sdt_open) {
+        if (upper > m_sdt_slope_upper) {
+            upper = m_sdt_slope_upper;
+        }
+        if (lower < m_sdt_slope_lower) {
+            lower = m_sdt_slope_lower;
+        }
+    }
+    if (!m_sdt_open || lower <= upper) {
+        m_sdt_slope_upper = upper;
+        m_sdt_slope_lower = lower;
+        m_sdt_open = true;
+        m_sdt_prev_value = value;
+        m_sdt_prev_ts = now;
+        return false;
+    }
 
-    // Sensor component topic
-    const char* units = "";
-    const char* device_class = nullptr;
+    // Door has closed, no single line fits anymore: archive the previous
+    // point and reopen the door from it through this one. The line to it may
+    // miss values in between by more than tolerance, so it is moved onto the
+    // nearest line that was still inside the door (at most tolerance away).
+    float prev_dt = (float)(m_sdt_prev_ts - m_sdt_ts);
+    float slope = (m_sdt_prev_value - m_sdt_value) / prev_dt;
+    if (slope > m_sdt_slope_upper) {
+        slope = m_sdt_slope_upper;
+    }
+    if (slope < m_sdt_slope_lower) {
+        slope = m_sdt_slope_lower;
+    }
+    m_sdt_value += slope * prev_dt;
+    m_sdt_ts = m_sdt_prev_ts;
+    dt = (float)(now - m_sdt_ts);
+    m_sdt_slope_upper = (value + m_sdt_tolerance - m_sdt_value) / dt;
+    m_sdt_slope_lower = (value - m_sdt_tolerance - m_sdt_value) / dt;
+    m_sdt_prev_value = value;
+    m_sdt_prev_ts = now;
+
+    value = m_sdt_value;
+    ts = m_sdt_ts;
+    return true;
+}
 
-    // Update sensor state even if value hasn't changed.
-    // This ensures Graphite/Grafana get regularly spaced samples!
-    json["frc_upd"] = true; // "force_update"
+// Publish the value for the current sample window
+void HAComponent<Component::Sensor>::flush(unsigned long now)
+{
+    // Combine the samples in the window
+    float avg_value;
+    if (!aggregate(avg_value)) {
+        if (m_reported && m_max_silence > 0 && now - m_last_report_ts >= m_max_silence) {
+            // No new samples, repeat the last value as a heartbeat
+            avg_value = m_last_value;
+        } else {
+            return;
+        }
+    }
 
-    switch (m_sensor_class) {
-        case SensorClass::Temperature:
-            device_class = SensorClassString<SensorClass::Temperature>::name;
-            units = "°C";
-            break;
-        case SensorClass::Humidity:
-            device_class = SensorClassString<SensorClass::Humidity>::name;
-            units = "%";
-            break;
-        case SensorClass::Battery:
-            device_class = SensorClassString<SensorClass::Battery>::name;
-            units = "%";
-            break;
-        case SensorClass::Illuminance:
-            device_class = SensorClassString<SensorClass::Illuminance>::name;
-            units = "lx";
-            break;
-        case SensorClass::Pressure:
-            device_class = SensorClassString<SensorClass::Pressure>::name;
-            units = "mbar"; // "hPa"
-            break;
-        case SensorClass::Power:
-            device_class = SensorClassString<SensorClass::Power>::name;
-            units = "W";
-            break;
-        case SensorClass::Energy:
-            device_class = SensorClassString<SensorClass::Energy>::name;
-            units = "Wh";
-            break;
-        case SensorClass::Voltage:
-            device_class = SensorClassString<SensorClass::Voltage>::name;
-            units = "V";
-            break;
-        case SensorClass::Dust:
-            device_class = nullptr;
-            units = "ug/m³";
-            break;
-        case SensorClass::PPM:
-            device_class = nullptr;
-            units = "ppm";
-            break;
-        case SensorClass::PPB:
-            device_class = nullptr;
-            units = "ppb";
-            break;
+    //Debug.print(m_id); Debug.print(": "); Debug.println(avg_value);
+
+    // Only publish if the value is significant
+    unsigned long ts = now;
+    if (!shouldReport(avg_value, ts, now)) {
+        m_stats.suppressed++;
+        m_global_stats.suppressed++;
     }
+    else if (std::isfinite(avg_value)) {
+        m_last_value = avg_value;
+        m_last_report_ts = now;
+        m_reported = true;
+        uint32_t timestamp = HAComponentManager::timestamp() - (uint32_t)((now - ts) / 1000);
+
+#if HA_OFFLINE_BUFFER_SIZE > 0
+        if (!context.transport.connected()) {
+            // Keep the sample to replay once reconnected
+            HAOfflineBuffer::push(this, timestamp, avg_value);
+            return;
+        }
+#endif
 
-    json["unit_of_meas"] = units; // "unit_of_measurement"
-    if (device_class != nullptr) {
-        json["dev_cla"] = device_class;
+        if (m_group != nullptr) {
+            // Published with the rest of the group
+            m_group->m_dirty = true;
+            return;
+        }
+
+        char value_s[24];
+        formatFloat(value_s, sizeof(value_s), avg_value, m_precision);
+        const char* state = value_s;
+        char point_s[48];
+        if (m_sdt_tolerance > 0.f) {
+            // Archived points are late, so carry the time they were sampled
+            snprintf(point_s, sizeof(point_s),
+                "{\"val\":%s,\"ts\":%lu}",
+                value_s, (unsigned long)timestamp);
+            state = point_s;
+        }
+        if (!HACompBase<Component::Sensor>::publishState(state, true, forceUpdate())) {
+#if HA_OFFLINE_BUFFER_SIZE > 0
+            HAOfflineBuffer::push(this, timestamp, avg_value);
+#endif
+        }
     }
 }
 
-// Generic publish implementation for sending sensor readings
-template<Component c>
-void HACompBase<c>::publishState(const char* value, bool retain)
+// Publish a previously buffered sample with its original timestamp
+bool HAComponent<Component::Sensor>::publishHistory(uint32_t timestamp, float value)
 {
-    //Led::SetBuiltin(true);
+    char topic[TOPIC_BUFFER_SIZE];
+    snprintf(topic, sizeof(topic),
+        "%s/%s/%s/history",
+        context.device_name, m_component, m_id);
 
-    // Debug.print("publish: ");
-    // Debug.print(m_state_topic);
-    // Debug.print(" ");
-    // Debug.print("=");
-    // Debug.println(value);
+    char value_s[24];
+    formatFloat(value_s, sizeof(value_s), value, m_precision);
 
-    context.client.publish(m_state_topic.c_str(), value, retain);
+    char payload[64];
+    snprintf(payload, sizeof(payload),
+        "{\"ts\":%lu,\"val\":%s}",
+        (unsigned long)timestamp, value_s);
 
-    //Led::SetBuiltin(false);
+    bool ok = context.transport.publish(topic, payload, false);
+    countPublish(ok, strlen(topic) + strlen(payload));
+    return ok;
 }
 
-template<Component c>
-void HACompBase<c>::clearState()
+#if HA_OFFLINE_BUFFER_SIZE > 0
+void HAOfflineBuffer::push(HAComponent<Component::Sensor>* sensor, uint32_t timestamp, float value)
 {
-    // Un-publish the state topic
-    // IMPORTANT: Use 4-arg overload. The 2 & 3-arg overloads try to call strlen() on payload
-    context.client.publish(m_state_topic.c_str(), nullptr, 0, true);
+    if (s_count == HA_OFFLINE_BUFFER_SIZE) {
+        // Drop the oldest sample
+        s_head = (s_head + 1) % HA_OFFLINE_BUFFER_SIZE;
+        s_count--;
+        s_dropped++;
+    }
+
+    Sample& sample = s_samples[(s_head + s_count) % HA_OFFLINE_BUFFER_SIZE];
+    sample.sensor = sensor;
+    sample.timestamp = timestamp;
+    sample.value = value;
+    s_count++;
 }
 
-// Sensor reading publish implementation
-void HAComponent<Component::Sensor>::update(float value)
+bool HAOfflineBuffer::replay(unsigned int max_samples)
 {
-    // Ensure value is not NaN or Infinity
-    if (!std::isfinite(value)) {
-        return;
+    while (s_count > 0 && max_samples > 0) {
+        Sample& sample = s_samples[s_head];
+        if (!sample.sensor->context.transport.connected() ||
+            !sample.sensor->publishHistory(sample.timestamp, sample.value)) {
+            return false;
+        }
+        s_head = (s_head + 1) % HA_OFFLINE_BUFFER_SIZE;
+        s_count--;
+        max_samples--;
     }
+    return (s_count == 0);
+}
+#endif
 
-    // Accumulate value
-    m_samples++;
-    m_sum += value;
+HASensorGroup::HASensorGroup(ComponentContext& context, const char* id)
+    : context(context), m_id(id), m_members(nullptr), m_dirty(false), m_next(s_groups)
+{
+    s_groups = this;
+}
+
+void HASensorGroup::initialize()
+{
+    char state_topic[TOPIC_BUFFER_SIZE];
+    snprintf(state_topic, sizeof(state_topic),
+        HA_STATE_TOPIC("%s", "sensor", "%s"),
+        context.device_name, m_id);
+    m_state_topic = state_topic;
+}
+
+void HASensorGroup::add(HAComponent<Component::Sensor>* sensor)
+{
+    sensor->m_group_next = m_members;
+    m_members = sensor;
+}
+
+// Write {"<id>":<value>,...} for every member that has reported a value
+size_t HASensorGroup::printTo(Print& out)
+{
+    size_t n = out.print('{');
+    bool first = true;
+    for (auto* sensor = m_members; sensor != nullptr; sensor = sensor->m_group_next) {
+        if (!sensor->m_reported) {
+            continue;
+        }
+        char value_s[24];
+        formatFloat(value_s, sizeof(value_s), sensor->m_last_value, sensor->m_precision);
 
-    long ts = millis();
-    if (ts - m_last_ts > m_sample_interval) {
-        m_last_ts = ts;
+        if (!first) {
+            n += out.print(',');
+        }
+        first = false;
+        n += out.print('"');
+        n += out.print(sensor->m_id);
+        n += out.print("\":");
+        n += out.print(value_s);
+    }
+    n += out.print('}');
+    return n;
+}
 
-        // Compute mean over the sample window
-        float avg_value = (m_samples > 0) ? (m_sum / (float)m_samples) : m_sum;
-        m_samples = 0;
-        m_sum = 0.f;
+bool HASensorGroup::flush()
+{
+    m_dirty = false;
 
-        //Debug.print(m_id); Debug.print(": "); Debug.println(avg_value);
+    LengthPrint length;
+    printTo(length);
 
-        // Only publish if the value is significant
-        if (std::isfinite(avg_value) && ((m_hysteresis == 0.0f) || (avg_value <= m_last_value - m_hysteresis || avg_value >= m_last_value + m_hysteresis))) {
-            m_last_value = avg_value;
+    bool ok = context.transport.beginPublish(m_state_topic.c_str(), length.length, true);
+    if (ok) {
+        ChunkPrint out(context.transport);
+        printTo(out);
+        out.flush();
+        ok = context.transport.endPublish();
+    }
+    HACompItem::m_global_stats.countPublish(ok, m_state_topic.length() + length.length);
+    return ok;
+}
 
-            String value_s(avg_value);
-            HACompBase<Component::Sensor>::publishState(value_s.c_str());
+void HASensorGroup::flushAll()
+{
+    for (auto group = s_groups; group != nullptr; group = group->m_next) {
+        if (group->m_dirty) {
+            group->flush();
         }
     }
 }
@@ -395,15 +2390,12 @@ void HAComponent<Component::BinarySensor>::getConfigInfo(JsonObject& json)
 
     // Sensor component topic
     const char* device_class = nullptr;
-
-    switch (m_sensor_class) {
-        // TODO...
-        // default:
-        //     Debug.println("WARNING: Device class unsupported!");
+    if (m_sensor_class < BinarySensorClass::Undefined) {
+        device_class = (const char*)pgm_read_ptr(&s_binary_sensor_classes[(size_t)m_sensor_class]);
     }
 
     if (device_class != nullptr) {
-        json["dev_cla"] = device_class;
+        json["dev_cla"] = FPSTR(device_class);
     }
 }
 
@@ -421,10 +2413,11 @@ HAAvailabilityComponent::HAAvailabilityComponent(ComponentContext& context)
 void HAAvailabilityComponent::initialize()
 {
     char state_topic[TOPIC_BUFFER_SIZE];
-    snprintf(state_topic, sizeof(state_topic), 
-        "%s/%s\0", 
+    snprintf(state_topic, sizeof(state_topic),
+        HA_AVAILABILITY_TOPIC("%s", "%s"),
         context.device_name, m_id);
-    m_state_topic = String(state_topic);
+    m_state_topic = state_topic;
+    context.availability = this;
 }
 
 void HAAvailabilityComponent::getConfigInfo(JsonObject& json)
@@ -436,14 +2429,213 @@ void HAAvailabilityComponent::getConfigInfo(JsonObject& json)
     json["dev_cla"] = "connectivity";
 }
 
-String HAAvailabilityComponent::getWillTopic()
+const char* HAAvailabilityComponent::getWillTopic()
 {
-    return m_state_topic;
+    return m_state_topic.c_str();
 }
 
 void HAAvailabilityComponent::connect()
 {
-    publishState(ONLINE);
+    // Always sent, the broker may have published our will since
+    publishState(ONLINE, true, true);
+}
+
+HAStatsComponent::HAStatsComponent(ComponentContext& context, unsigned long interval_ms, const char* id, const char* name)
+    : HACompBase(context, id, name),
+      m_timer(this, interval_ms)
+{
+    m_icon = "mdi:chart-line";
+}
+
+void HAStatsComponent::initialize()
+{
+    HACompBase<Component::Sensor>::initialize();
+
+    HAComponentManager::schedule(m_timer);
+}
+
+void HAStatsComponent::getConfigInfo(JsonObject& json)
+{
+    json["ent_cat"]     = "diagnostic"; // "entity_category"
+    json["stat_cla"]    = "total_increasing"; // "state_class"
+    json["val_tpl"]     = "{{ value_json.publishes }}"; // "value_template"
+    json["json_attr_t"] = m_state_topic.c_str(); // "json_attributes_topic"
+}
+
+size_t HAStatsComponent::printTo(Print& out)
+{
+    const HAStats& stats = HAComponentManager::getGlobalStats();
+    size_t n = 0;
+    n += out.print("{\"publishes\":");    n += out.print((unsigned long)stats.publishes);
+    n += out.print(",\"failed\":");       n += out.print((unsigned long)stats.failed);
+    n += out.print(",\"bytes\":");        n += out.print((unsigned long)stats.bytes);
+    n += out.print(",\"suppressed\":");   n += out.print((unsigned long)stats.suppressed);
+    n += out.print(",\"commands\":");     n += out.print((unsigned long)stats.commands);
+    n += out.print(",\"latency_us\":[");
+    for (size_t i = 0; i < HA_LATENCY_BUCKETS; i++) {
+        if (i > 0) {
+            n += out.print(',');
+        }
+        n += out.print((unsigned long)m_latency_hist[i]);
+    }
+    n += out.print("]}");
+    return n;
+}
+
+void HAStatsComponent::onTimer(unsigned long now)
+{
+    LengthPrint length;
+    printTo(length);
+
+    bool ok = context.transport.beginPublish(m_state_topic.c_str(), length.length, false);
+    if (ok) {
+        ChunkPrint out(context.transport);
+        printTo(out);
+        out.flush();
+        ok = context.transport.endPublish();
+    }
+    countPublish(ok, m_state_topic.length() + length.length);
+}
+
+HAComponent<Component::Counter>::HAComponent(ComponentContext& context, const char* id, const char* name, unsigned long interval_ms,
+                                             float pulses_per_unit, const char* unit, const char* device_class, const char* icon)
+    : HACompBase(context, id, name, device_class),
+      m_pulses(0),
+      m_reported_pulses(0),
+      m_total_pulses(0),
+      m_pulses_per_unit(pulses_per_unit),
+      m_unit(unit),
+      m_precision(3),
+      m_timer(this, interval_ms),
+      m_last_ts(0)
+{
+    m_icon = icon;
+}
+
+void HAComponent<Component::Counter>::initialize()
+{
+    HACompBase<Component::Counter>::initialize();
+
+    m_last_ts = millis();
+    HAComponentManager::schedule(m_timer);
+}
+
+void HAComponent<Component::Counter>::getConfigInfo(JsonObject& json)
+{
+    json["stat_cla"]     = "total_increasing"; // "state_class"
+    json["val_tpl"]      = "{{ value_json.total }}"; // "value_template"
+    json["unit_of_meas"] = m_unit; // "unit_of_measurement"
+    json["sug_dsp_prc"]  = m_precision; // "suggested_display_precision"
+    if (m_device_class != nullptr) {
+        json["dev_cla"] = m_device_class;
+    }
+}
+
+// Format pulses / pulses_per_unit with precision decimals. Exact for a
+// whole number of pulses per unit, where the float total would round off
+// above 2^24 pulses.
+static void formatTotal(char* buf, size_t size, uint64_t pulses, float pulses_per_unit, uint8_t precision)
+{
+    static const uint32_t scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    const uint32_t scale = scales[precision];
+
+    uint64_t scaled;
+    if (pulses_per_unit >= 1.f && pulses_per_unit < 4294967296.f && floorf(pulses_per_unit) == pulses_per_unit) {
+        uint64_t per_unit = (uint64_t)pulses_per_unit;
+        uint64_t units = pulses / per_unit;
+        if (units > (UINT64_MAX - scale) / scale) {
+            snprintf(buf, size, "%.0f", (double)units);
+            return;
+        }
+        // Remainder rounded to the nearest, carried into units at .5 and up
+        uint64_t frac = ((pulses % per_unit) * scale * 2 + per_unit) / (per_unit * 2);
+        scaled = units * scale + frac;
+    } else {
+        double total = (double)pulses / pulses_per_unit * scale + 0.5;
+        if (!(total >= 0.0 && total < 9.2e18)) {
+            snprintf(buf, size, "%.9g", (double)pulses / pulses_per_unit);
+            return;
+        }
+        scaled = (uint64_t)total;
+    }
+
+    // Build the string backwards, as formatFloat (20 digits, point and 6 decimals)
+    char tmp[28];
+    char* p = tmp + sizeof(tmp);
+    *--p = '\0';
+    for (uint8_t i = 0; i < precision; i++) {
+        *--p = '0' + (char)(scaled % 10);
+        scaled /= 10;
+    }
+    if (precision > 0) {
+        *--p = '.';
+    }
+    do {
+        *--p = '0' + (char)(scaled % 10);
+        scaled /= 10;
+    } while (scaled > 0);
+
+    snprintf(buf, size, "%s", p);
+}
+
+void HAComponent<Component::Counter>::onTimer(unsigned long now)
+{
+    // Unsigned difference, so the 32 bit pulse count may wrap
+    uint32_t pulses = m_pulses.load(std::memory_order_relaxed);
+    uint32_t delta = pulses - m_reported_pulses;
+    m_reported_pulses = pulses;
+    m_total_pulses += delta;
+
+    float rate = 0.f;
+    if (now != m_last_ts) {
+        rate = (float)delta / m_pulses_per_unit * 3600000.f / (float)(now - m_last_ts);
+    }
+    m_last_ts = now;
+
+    char total_s[32];
+    char rate_s[24];
+    char state[80];
+    formatTotal(total_s, sizeof(total_s), m_total_pulses, m_pulses_per_unit, m_precision);
+    formatFloat(rate_s, sizeof(rate_s), rate, 6);
+    snprintf(state, sizeof(state), "{\"total\":%s,\"rate\":%s}", total_s, rate_s);
+    publishState(state);
+}
+
+HACounterRate::HACounterRate(ComponentContext& context, const char* counter_id, const char* id, const char* name,
+                             const char* unit, float scale, const char* device_class, const char* icon)
+    : HACompBase(context, id, name, device_class),
+      m_counter_id(counter_id),
+      m_unit(unit),
+      m_scale(scale)
+{
+    m_icon = icon;
+}
+
+void HACounterRate::initialize()
+{
+    // Read from the counter's state topic, published by the counter
+    char state_topic[TOPIC_BUFFER_SIZE];
+    snprintf(state_topic, sizeof(state_topic),
+        HA_STATE_TOPIC("%s", "%s", "%s"),
+        context.device_name, m_component, m_counter_id);
+    m_state_topic = state_topic;
+}
+
+void HACounterRate::getConfigInfo(JsonObject& json)
+{
+    char value_template[64];
+    if (m_scale == 1.f) {
+        snprintf(value_template, sizeof(value_template), "{{ value_json.rate }}");
+    } else {
+        snprintf(value_template, sizeof(value_template), "{{ value_json.rate * %g }}", m_scale);
+    }
+
+    json["stat_cla"]     = "measurement"; // "state_class"
+    json["val_tpl"]      = value_template; // "value_template"
+    json["unit_of_meas"] = m_unit; // "unit_of_measurement"
+    if (m_device_class != nullptr) {
+        json["dev_cla"] = m_device_class;
+    }
 }
 
 // Explicit template instantiations. Required to make the CPP linker happy
@@ -452,4 +2644,5 @@ template class HAComponent<Component::Sensor>;
 template class HACompBase<Component::Switch>;
 template class HAComponent<Component::Switch>;
 template class HACompBase<Component::BinarySensor>;
-template class HAComponent<Component::BinarySensor>;
\ No newline at end of file
+template class HAComponent<Component::BinarySensor>;
+template class HACompBase<Component::Counter>;
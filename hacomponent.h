@@ -2,17 +2,312 @@
 
 #include <Arduino.h>
 #include <vector>
+#include <functional>
+#include <atomic>
 #include <ArduinoJson.h>
 #include <PubSubClient.h>
 
-#define HA_MQTT_MAX_PACKET_SIZE (1024)
+// Config payloads are streamed straight to the socket (beginPublish/endPublish),
+// so the PubSubClient buffer only needs to hold the largest state/command message.
+#ifndef HA_MQTT_MAX_PACKET_SIZE
+#define HA_MQTT_MAX_PACKET_SIZE (256)
+#endif
 
 #define TOPIC_BUFFER_SIZE (80)
-#define JSON_BUFFER_SIZE (HA_MQTT_MAX_PACKET_SIZE)
 
+// Streamed payloads are collected into chunks of this many bytes (on the stack)
+// before being written to the transport, rather than written a byte or token at a time
+#ifndef HA_PUBLISH_CHUNK_SIZE
+#define HA_PUBLISH_CHUNK_SIZE (64)
+#endif
+
+// Topics as string literals, for sketches with a fixed device name, eg.
+//     client.publish(HA_STATE_TOPIC("kitchen", "sensor", "temp"), ...)
+// Components build their topics at runtime from these same formats (eg.
+// HA_STATE_TOPIC("%s", "%s", "%s")), filled in from ComponentContext::device_name.
+#define HA_STATE_TOPIC(device, platform, id)    device "/" platform "/" id "/state"
+#define HA_COMMAND_TOPIC(device, id)            device "/switch/" id "/ctrl"
+#define HA_CONFIG_NODE(platform, device, id)    "homeassistant/" platform "/" device "/" id
+#define HA_CONFIG_TOPIC(platform, device, id)   HA_CONFIG_NODE(platform, device, id) "/config"
+#define HA_AVAILABILITY_TOPIC(device, id)       device "/" id
+#define HA_UNIQUE_ID(device, id)                device "_" id
+
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(addr) (*(const void* const*)(addr))
+#endif
+#ifndef FPSTR
+#define FPSTR(p) (reinterpret_cast<const __FlashStringHelper*>(p))
+#endif
+
+// Define HA_NO_HEAP to avoid all runtime heap allocations:
+// topics are stored inline in fixed-size buffers and switch callbacks
+// are plain function pointers (or function + context pointer).
+#ifdef HA_NO_HEAP
+// Number of buckets in the switch command dispatch table (power of two)
+#ifndef HA_SWITCH_DISPATCH_SIZE
+#define HA_SWITCH_DISPATCH_SIZE (32)
+#endif
+// Number of buckets in the device name lookup table (power of two)
+#ifndef HA_CONTEXT_TABLE_SIZE
+#define HA_CONTEXT_TABLE_SIZE (4)
+#endif
+#endif
+
+// Size of the JSON tree used to build a config payload (not the payload itself)
+#ifndef JSON_BUFFER_SIZE
+#define JSON_BUFFER_SIZE (1024)
+#endif
+
+// Size of the JSON tree used to build a device discovery payload
+// (see HAComponentManager::setDeviceDiscovery). Statically allocated,
+// 4096 fits about a dozen components. 0 compiles device discovery out.
+#ifndef HA_DEVICE_JSON_BUFFER_SIZE
+#define HA_DEVICE_JSON_BUFFER_SIZE (0)
+#endif
+
+// How long to collect retained config messages before diffing against them
+#ifndef HA_CONFIG_SYNC_MS
+#define HA_CONFIG_SYNC_MS (1000)
+#endif
+
+// Bytes reserved for caching serialized config payloads (0 to disable).
+// Filled by HAComponentManager::initializeAll(), configs that don't fit are
+// built on each publish as usual.
+#ifndef HA_CONFIG_CACHE_SIZE
+#define HA_CONFIG_CACHE_SIZE (0)
+#endif
+
+// HA's birth/last will topic (see HAComponentManager::setRediscoverOnBirth)
+#ifndef HA_STATUS_TOPIC
+#define HA_STATUS_TOPIC "homeassistant/status"
+#endif
+
+// Maximum random delay before republishing configs when HA comes online,
+// so many devices don't all republish at once
+#ifndef HA_REDISCOVERY_JITTER_MS
+#define HA_REDISCOVERY_JITTER_MS (5000)
+#endif
+
+#ifdef HA_NO_HEAP
+// Fixed capacity topic string, a drop-in for the String members it replaces
+class HATopic {
+    char m_buf[TOPIC_BUFFER_SIZE];
+public:
+    HATopic() { m_buf[0] = '\0'; }
+    HATopic& operator=(const char* s) {
+        strncpy(m_buf, s, sizeof(m_buf) - 1);
+        m_buf[sizeof(m_buf) - 1] = '\0';
+        return *this;
+    }
+    const char* c_str() const { return m_buf; }
+    size_t length() const { return strlen(m_buf); }
+};
+
+// Non-allocating delegate for switch callbacks.
+// Accepts captureless lambdas/function pointers, or a function taking a context pointer.
+class HASwitchCallback {
+    void (*m_fn)(boolean);
+    void (*m_ctx_fn)(void*, boolean);
+    void* m_ctx;
+public:
+    template<typename F>
+    HASwitchCallback(F fn) : m_fn(fn), m_ctx_fn(nullptr), m_ctx(nullptr) { }
+    HASwitchCallback(void (*fn)(void*, boolean), void* ctx) : m_fn(nullptr), m_ctx_fn(fn), m_ctx(ctx) { }
+
+    void operator()(boolean state) const {
+        if (m_ctx_fn != nullptr) {
+            m_ctx_fn(m_ctx, state);
+        }
+        else if (m_fn != nullptr) {
+            m_fn(state);
+        }
+    }
+};
+#else
+typedef String HATopic;
+typedef std::function<void(boolean)> HASwitchCallback;
+#endif
+
+// Outbound queue of HAQueuedTransport, in bytes (topic + payload + 5 per message)
+#ifndef HA_TRANSPORT_QUEUE_SIZE
+#define HA_TRANSPORT_QUEUE_SIZE (2048)
+#endif
+
+// Messages HAQueuedTransport hands to the underlying transport per service() call
+#ifndef HA_TRANSPORT_DRAIN_BATCH
+#define HA_TRANSPORT_DRAIN_BATCH (8)
+#endif
+
+// Largest payload / number of subscriptions of HALoopbackTransport
+#ifndef HA_LOOPBACK_BUFFER_SIZE
+#define HA_LOOPBACK_BUFFER_SIZE (JSON_BUFFER_SIZE)
+#endif
+#ifndef HA_LOOPBACK_SUBSCRIPTIONS
+#define HA_LOOPBACK_SUBSCRIPTIONS (8)
+#endif
+
+/// @brief MQTT connection used by components to publish and subscribe.
+/// Payloads are either published in one go, or streamed with
+/// beginPublish(), write() (Print) and endPublish().
+class HATransport : public Print {
+public:
+    virtual bool connected() = 0;
+    virtual bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) = 0;
+    virtual bool beginPublish(const char* topic, unsigned int length, bool retain) = 0;
+    virtual bool endPublish() = 0;
+    virtual bool subscribe(const char* topic) = 0;
+    virtual bool unsubscribe(const char* topic) = 0;
+
+    /// @brief Connect to the broker, with an optional (retained) will message
+    virtual bool connect(const char* id, const char* user, const char* password,
+                         const char* will_topic = nullptr, const char* will_message = nullptr) { return connected(); }
+
+    /// @brief Called from HAComponentManager::service()
+    virtual void loop() { }
+
+    /// @brief Identifies the underlying connection, so devices sharing it can be found
+    virtual const void* getConnection() const { return this; }
+
+    bool publish(const char* topic, const char* payload, bool retain) {
+        return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retain);
+    }
+
+    using Print::write;
+};
+
+/// @brief Synchronous transport on top of a PubSubClient
+class HAPubSubTransport : public HATransport {
+public:
+    using HATransport::publish;
+    using HATransport::write;
+
+    HAPubSubTransport(PubSubClient* client)
+        : m_client(client)
+    { }
+
+    bool connected() override;
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) override;
+    bool beginPublish(const char* topic, unsigned int length, bool retain) override;
+    bool endPublish() override;
+    bool subscribe(const char* topic) override;
+    bool unsubscribe(const char* topic) override;
+    bool connect(const char* id, const char* user, const char* password,
+                 const char* will_topic = nullptr, const char* will_message = nullptr) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    const void* getConnection() const override { return m_client; }
+
+protected:
+    PubSubClient* m_client;
+};
+
+/// @brief Asynchronous transport: publishes are copied into a fixed queue
+/// and handed to the underlying transport from service(), several per call.
+/// A message stays queued until the underlying transport accepts it, so
+/// publishes made while disconnected or on a slow link aren't lost or blocking
+/// (until the queue fills up, see getDropped()).
+class HAQueuedTransport : public HATransport {
+public:
+    using HATransport::publish;
+    using HATransport::write;
+
+    HAQueuedTransport(HATransport& transport)
+        : m_transport(transport)
+    { }
+
+    bool connected() override { return m_transport.connected(); }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) override;
+    bool beginPublish(const char* topic, unsigned int length, bool retain) override;
+    bool endPublish() override;
+    bool subscribe(const char* topic) override { return m_transport.subscribe(topic); }
+    bool unsubscribe(const char* topic) override { return m_transport.unsubscribe(topic); }
+    bool connect(const char* id, const char* user, const char* password,
+                 const char* will_topic = nullptr, const char* will_message = nullptr) override {
+        return m_transport.connect(id, user, password, will_topic, will_message);
+    }
+    size_t write(uint8_t c) override;
+    void loop() override;
+    const void* getConnection() const override { return m_transport.getConnection(); }
+
+    /// @brief Number of queued messages
+    size_t getQueued() const { return m_count; }
+    /// @brief Number of messages that didn't fit in the queue
+    uint32_t getDropped() const { return m_dropped; }
+
+protected:
+    HATransport& m_transport;
+    uint8_t m_queue[HA_TRANSPORT_QUEUE_SIZE];
+    size_t m_head = 0;      // Oldest queued message
+    size_t m_tail = 0;      // End of the last complete message
+    size_t m_used = 0;      // Bytes used by complete messages
+    size_t m_count = 0;
+    uint32_t m_dropped = 0;
+
+    // Message being streamed in
+    size_t m_write = 0;
+    size_t m_size = 0;
+    size_t m_remaining = 0;
+    bool m_writing = false;
+
+    void put(size_t& pos, uint8_t c);
+    uint8_t get(size_t& pos) const;
+};
+
+/// @brief In-memory transport for tests: keeps the last published message,
+/// and delivers publishes on subscribed topics (with + and # wildcards)
+/// back to HAComponentManager::onMessageReceived().
+class HALoopbackTransport : public HATransport {
+public:
+    using HATransport::publish;
+    using HATransport::write;
+
+    bool connected() override { return m_connected; }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) override;
+    bool beginPublish(const char* topic, unsigned int length, bool retain) override;
+    bool endPublish() override;
+    bool subscribe(const char* topic) override;
+    bool unsubscribe(const char* topic) override;
+    bool connect(const char* id, const char* user, const char* password,
+                 const char* will_topic = nullptr, const char* will_message = nullptr) override;
+    size_t write(uint8_t c) override;
+
+    /// @brief Simulate a lost connection (publishes fail until connect())
+    void disconnect() { m_connected = false; }
+
+    const char* getLastTopic() const { return m_topic; }
+    const uint8_t* getLastPayload() const { return m_payload; }
+    unsigned int getLastLength() const { return m_length; }
+    bool getLastRetain() const { return m_retain; }
+    uint32_t getPublished() const { return m_published; }
+
+    static bool topicMatches(const char* filter, const char* topic);
+
+protected:
+    bool m_connected = false;
+    char m_topic[TOPIC_BUFFER_SIZE] = "";
+    uint8_t m_payload[HA_LOOPBACK_BUFFER_SIZE + 1];
+    unsigned int m_length = 0;
+    unsigned int m_expected = 0;
+    bool m_retain = false;
+    bool m_writing = false;
+    uint32_t m_published = 0;
+    HATopic m_subscriptions[HA_LOOPBACK_SUBSCRIPTIONS];
+
+    void deliver();
+};
+
+class HACompItem;
+class HAAvailabilityComponent;
+
+// A device, and the components registered to it.
+// Several contexts may share one client (eg. a gateway bridging many devices).
 class ComponentContext {
+    friend class HAComponentManager;
+protected:
+    HAPubSubTransport m_pubsub;
+
 public:
-    PubSubClient& client;
+    HATransport& transport;
     const char* mac_address;
     const char* device_name;
     const char* friendly_name;
@@ -20,16 +315,78 @@ public:
     const char* model;
     const char* manufacturer;
 
+    // This device's availability component, if any.
+    // Set by HAComponentManager::initializeAll()
+    HAAvailabilityComponent* availability;
+
+    // The device whose availability topic is the connection's will, when this one
+    // is bridged over another device's connection. Its configs then list both topics.
+    // Set by HAComponentManager::connectClientWithAvailability()
+    ComponentContext* gateway;
+
     ComponentContext(PubSubClient& client)
-        : client(client)
+        : m_pubsub(&client),
+          transport(m_pubsub),
+          mac_address(nullptr),
+          device_name(nullptr),
+          friendly_name(nullptr),
+          fw_version(nullptr),
+          model(nullptr),
+          manufacturer(nullptr),
+          availability(nullptr),
+          gateway(nullptr),
+          m_components(nullptr),
+          m_components_tail(nullptr),
+          m_next(nullptr),
+          m_loop_next(nullptr),
+          m_hash_next(nullptr),
+          m_name_hash(0),
+          m_registered(false)
     { }
+
+    ComponentContext(HATransport& transport)
+        : m_pubsub(nullptr),
+          transport(transport),
+          mac_address(nullptr),
+          device_name(nullptr),
+          friendly_name(nullptr),
+          fw_version(nullptr),
+          model(nullptr),
+          manufacturer(nullptr),
+          availability(nullptr),
+          gateway(nullptr),
+          m_components(nullptr),
+          m_components_tail(nullptr),
+          m_next(nullptr),
+          m_loop_next(nullptr),
+          m_hash_next(nullptr),
+          m_name_hash(0),
+          m_registered(false)
+    { }
+
+protected:
+    // Per-device registry, built by HAComponentManager::initializeAll()
+    HACompItem* m_components;
+    HACompItem* m_components_tail;
+    ComponentContext* m_next;
+
+    // Next context with a transport to loop() (see HAComponentManager::service):
+    // contexts made from the same PubSubClient share one, as do contexts sharing a transport
+    ComponentContext* m_loop_next;
+    const void* getLoopKey() const { return (&transport == &m_pubsub) ? transport.getConnection() : &transport; }
+
+    // Device name lookup (see HAComponentManager::findContext)
+    ComponentContext* m_hash_next;
+    uint32_t m_name_hash;
+    bool m_registered;
 };
 
 enum class Component {
     Undefined,
     Sensor,
     BinarySensor,
-    Switch
+    Switch,
+    Counter     // Pulse counter, a sensor in HA
 };
 
 template<Component c>
@@ -57,14 +414,8 @@ enum class SensorClass {
     PPB
 };
 
-template<SensorClass c>
-struct SensorClassString {
-public:
-    static const char* name;
-};
-
-// TODO: Need to define strings for these
 // https://github.com/home-assistant/home-assistant/blob/70ce9bb7bc15b1a66bb1d21598efd0bb8b102522/homeassistant/components/binary_sensor/__init__.py
+// Names are sent as-is as the device class, so keep them in sync with HA.
 enum class BinarySensorClass {
     battery,       // On means low, Off means normal
     cold,          // On means cold, Off means normal
@@ -92,17 +443,209 @@ enum class BinarySensorClass {
     Undefined
 };
 
+// Number of sensor samples kept while MQTT is disconnected (0 to disable).
+// Buffered samples are replayed from service() after reconnecting, oldest first,
+// HA_OFFLINE_REPLAY_BATCH at a time, to <device>/sensor/<id>/history as {"ts":<time>,"val":<value>}
+#ifndef HA_OFFLINE_BUFFER_SIZE
+#define HA_OFFLINE_BUFFER_SIZE (0)
+#endif
+#ifndef HA_OFFLINE_REPLAY_BATCH
+#define HA_OFFLINE_REPLAY_BATCH (8)
+#endif
+
+// Reporting scheduler timer wheel: HA_TIMER_WHEEL_SLOTS slots of HA_TIMER_TICK_MS each
+#ifndef HA_TIMER_TICK_MS
+#define HA_TIMER_TICK_MS (10)
+#endif
+#ifndef HA_TIMER_WHEEL_SLOTS
+#define HA_TIMER_WHEEL_SLOTS (64)
+#endif
+
+class HACompItem;
+
+// Entry in the manager's reporting scheduler.
+// Deadlines are aligned to multiples of the interval, so components
+// with the same interval fire on the same tick.
+struct HATimer {
+    HACompItem* owner;
+    HATimer* next;
+    unsigned long interval;
+    unsigned long deadline;
+    bool scheduled;
+
+    HATimer(HACompItem* owner, unsigned long interval)
+        : owner(owner), next(nullptr), interval(interval), deadline(0), scheduled(false)
+    { }
+
+    // millis() wraparound safe
+    bool due(unsigned long now) const { return (long)(now - deadline) >= 0; }
+
+    // Set the deadline to the next aligned multiple of interval after now
+    void advance(unsigned long now) {
+        deadline = (interval > 0) ? ((now / interval) + 1) * interval : now;
+    }
+};
+
+// Counters for config publishing (see HAComponentManager::setConfigDiff)
+struct HAConfigStats {
+    uint32_t published;     // Configs sent to the broker
+    uint32_t skipped;       // Configs not sent because the retained copy matched
+    uint32_t removed;       // Orphaned retained configs that were unpublished
+};
+
+// Number of log2 buckets in the command latency histogram.
+// Bucket i counts latencies of [2^i, 2^(i+1)) us, the last bucket everything above.
+#ifndef HA_LATENCY_BUCKETS
+#define HA_LATENCY_BUCKETS (16)
+#endif
+
+// Identical state payloads are not republished until this long after the last publish,
+// see HAComponentManager::setStateRefresh
+#ifndef HA_STATE_REFRESH_MS
+#define HA_STATE_REFRESH_MS (15 * 60 * 1000UL)
+#endif
+
+// Performance counters, kept per component and globally
+struct HAStats {
+    uint32_t publishes;     // Successful publishes
+    uint32_t failed;        // Failed publishes
+    uint32_t bytes;         // Topic + payload bytes published
+    uint32_t suppressed;    // States not published (reporting policy, or unchanged payload)
+    uint32_t commands;      // Inbound commands handled
+
+    void countPublish(bool ok, size_t length) {
+        if (ok) {
+            publishes++;
+            bytes += length;
+        } else {
+            failed++;
+        }
+    }
+};
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+// Number of state changes queued per component from interrupts (power of two, max 128)
+#ifndef HA_EVENT_QUEUE_SIZE
+#define HA_EVENT_QUEUE_SIZE (8)
+#endif
+static_assert(HA_EVENT_QUEUE_SIZE > 0 && (HA_EVENT_QUEUE_SIZE & (HA_EVENT_QUEUE_SIZE - 1)) == 0 && HA_EVENT_QUEUE_SIZE <= 128,
+              "HA_EVENT_QUEUE_SIZE must be a power of two, at most 128 (indices are uint8_t)");
+
+/// @brief Lock-free single producer (interrupt) / single consumer (service())
+/// queue of on/off states. Only edges are queued, repeated states are coalesced.
+/// When full, further edges are dropped and counted, but the latest state is
+/// still reported once the queue has drained.
+class HAEventQueue {
+    friend class HAComponentManager;
+public:
+    HAEventQueue(HACompItem* owner)
+        : m_owner(owner)
+    { }
+
+    /// @brief Drain this queue from HAComponentManager::service()
+    void enable();
+
+    /// @brief Queue a state. Interrupt safe.
+    void IRAM_ATTR push(bool state);
+
+    /// @brief Number of edges dropped because the queue was full
+    uint32_t getOverflows() const { return m_overflows.load(std::memory_order_relaxed); }
+
+protected:
+    HACompItem* m_owner;
+    HAEventQueue* m_next = nullptr;
+    bool m_enabled = false;
+    static HAEventQueue* s_queues;
+
+    volatile uint8_t m_events[HA_EVENT_QUEUE_SIZE];
+    std::atomic<uint8_t> m_head { 0 };          // Written by the producer
+    std::atomic<uint8_t> m_tail { 0 };          // Written by the consumer
+    std::atomic<int8_t> m_overflow_state { -1 };// Latest state not queued, or -1
+    std::atomic<uint32_t> m_overflows { 0 };
+    int8_t m_pushed = -1;                       // Producer side, last state queued
+    int8_t m_drained = -1;                      // Consumer side, last state handled
+
+    void drain();
+    static void drainAll();
+};
+
 // Abstract class that allows us to initialize and publish
 // any type of component
 class HACompItem
 {
     friend class HAComponentManager;
+    friend class HAEventQueue;
+
+protected:
+    // Registered components (intrusive list, in registration order)
+    static HACompItem* m_components;
+    static HACompItem* m_components_tail;
+    HACompItem* m_next = nullptr;
+    HACompItem* m_context_next = nullptr;
+
+    // Retained config diffing
+    static bool m_config_diff;
+    static HAConfigStats m_config_stats;
+    uint32_t m_config_topic_hash = 0;
+    uint32_t m_retained_hash = 0;
+    bool m_retained = false;
+
+#if HA_CONFIG_CACHE_SIZE > 0
+    // Serialized config payload, in HAComponentManager's cache arena
+    const uint8_t* m_config_cache = nullptr;
+    uint16_t m_config_cache_length = 0;
+    uint32_t m_config_cache_hash = 0;
+
+    bool publishCachedConfig(const char* topic);
+#endif
+
+    // Performance counters
+    HAStats m_stats = { };
+    static HAStats m_global_stats;
+    static uint32_t m_latency_hist[HA_LATENCY_BUCKETS];
+
+    // Duplicate state suppression. Fingerprints from an older epoch
+    // (ie. before the last connect) are ignored.
+    static unsigned long m_state_refresh;
+    static uint32_t m_connect_epoch;
+
+    static void registerItem(HACompItem* item);
+
+    void countPublish(bool ok, size_t length) {
+        m_stats.countPublish(ok, length);
+        m_global_stats.countPublish(ok, length);
+    }
+    static void recordLatency(unsigned long us);
+
+public:
+    const HAStats& getStats() const { return m_stats; }
 
 protected:
-    static std::vector<HACompItem*> m_components;
+
+    virtual ComponentContext& getContext() = 0;
+    virtual void getConfigTopic(char* topic, size_t size) = 0;
+    virtual const char* getPlatform() = 0;
+    virtual const char* getId() = 0;
+
+    /// Fill in the discovery config for this component, excluding device information
+    virtual void buildConfig(JsonObject& json) = 0;
+
+    /// Called once HA has been sent this component's config
+    virtual void onConfigPublished() { }
+    virtual void clearState() = 0;
 
     virtual void initialize() = 0;
-    virtual void publishConfig(bool present) = 0;
+    /// @return false if the config could not be published
+    virtual bool publishConfig(bool present) = 0;
+
+    /// Called by the scheduler when this component's HATimer is due
+    virtual void onTimer(unsigned long now) { }
+
+    /// Called from service() for each state queued from an interrupt (see HAEventQueue)
+    virtual void onEvent(bool state) { }
 };
 
 // Manager class for interacting with all registered components
@@ -111,27 +654,158 @@ class HAComponentManager: public HACompItem
 public:
     /// @brief Initialize all registered copmonents with the provided context.
     /// MQTT connection is not required yet.
-    static void initializeAll() {
-        for (auto item : HACompItem::m_components) {
-            item->initialize();
-        }
-    }
+    /// Also builds the per-device registries and the command dispatch tables.
+    static void initializeAll();
+
+    /// @brief Publish the components of one device to HomeAssistant.
+    static void publishConfigAll(ComponentContext& context, bool present = true);
+
+#if HA_CONFIG_CACHE_SIZE > 0
+    /// @brief Bytes of the config cache in use, to help size HA_CONFIG_CACHE_SIZE
+    static size_t getConfigCacheUsed() { return s_config_cache_used; }
+#endif
+
+    /// @brief Find the context for a device name (not necessarily NUL-terminated)
+    static ComponentContext* findContext(const char* device_name, size_t length);
 
     /// @brief Publish all registered components to HomeAssistant.
     /// Requires an active MQTT connection.
     /// @param present true to publish, false to unpublish
-    static void publishConfigAll(bool present = true) {
-        for (auto item : HACompItem::m_components) {
-            item->publishConfig(present);
-        }
-    }
+    static void publishConfigAll(bool present = true);
+
+    /// @brief Begin publishing all registered components incrementally from service().
+    /// Restarts from the first component if a pass is already in progress.
+    /// @param present true to publish, false to unpublish
+    static void requestConfigAll(bool present = true);
+
+    /// @brief Call from loop() to run the reporting scheduler and make progress on any
+    /// requested config publishing, without blocking for more than max_messages config publishes.
+    /// If a publish fails (eg. MQTT disconnected) the same component is retried on
+    /// the next call, so progress is kept across reconnects.
+    /// @return true once all requested configs have been published
+    static bool service(unsigned int max_messages = 1);
+
+    /// @brief Add a timer to the reporting scheduler, firing at the next aligned deadline.
+    static void schedule(HATimer& timer);
+
+    /// @brief true once service() is being called, after which sensor reporting
+    /// is driven by the scheduler rather than by update()
+    static bool isScheduling() { return s_scheduling; }
+
+    /// @brief Set the clock used to timestamp buffered samples, eg. seconds since epoch from NTP.
+    /// Defaults to seconds since boot.
+    static void setTimeSource(uint32_t (*time_source)()) { s_time_source = time_source; }
+    static uint32_t timestamp() { return (s_time_source != nullptr) ? s_time_source() : (millis() / 1000); }
+
+    /// @brief true if no requested config publishing is outstanding
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+    static bool isConfigComplete() { return s_config_cursor == nullptr && s_device_cursor == nullptr && !s_config_syncing; }
+#else
+    static bool isConfigComplete() { return s_config_cursor == nullptr && !s_config_syncing; }
+#endif
+
+    /// @brief Only publish configs that differ from what the broker has retained.
+    /// When enabled, requestConfigAll() first subscribes to this device's config topics
+    /// and collects the retained payloads for HA_CONFIG_SYNC_MS, then service() skips
+    /// components whose config is unchanged and unpublishes retained configs that
+    /// no longer belong to any component.
+    /// The retained configs are received through the PubSubClient buffer, so it must
+    /// hold a whole config message (typically 400-700 bytes, more than the
+    /// HA_MQTT_MAX_PACKET_SIZE needed otherwise). PubSubClient drops messages that
+    /// don't fit, and those configs are then republished every time.
+    static void setConfigDiff(bool enable) { m_config_diff = enable; }
+
+    /// @brief Subscribe to HA_STATUS_TOPIC on connect, and requestConfigAll() when HA
+    /// announces it is online (after a random delay of up to HA_REDISCOVERY_JITTER_MS).
+    /// Configs then only need publishing once after boot, not on every reconnect.
+    static void setRediscoverOnBirth(bool enable) { s_rediscover_on_birth = enable; }
+
+    static const HAConfigStats& getConfigStats() { return m_config_stats; }
+
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+    /// @brief Publish all components of a device as a single homeassistant/device/<device>/config
+    /// message with a shared device and origin block, instead of one config per component.
+    /// Devices whose payload doesn't fit HA_DEVICE_JSON_BUFFER_SIZE fall back to per-component configs.
+    static void setDeviceDiscovery(bool enable) { s_device_discovery = enable; }
+#endif
+
+    /// @brief Republish unchanged component states at most every refresh_ms
+    /// (HA_STATE_REFRESH_MS by default). 0 publishes every state.
+    /// States are always republished after (re)connecting.
+    static void setStateRefresh(unsigned long refresh_ms) { HACompItem::m_state_refresh = refresh_ms; }
+
+    /// @brief Counters summed over all components
+    static const HAStats& getGlobalStats() { return m_global_stats; }
+
+    /// @brief Command to state report latency histogram (HA_LATENCY_BUCKETS log2 microsecond buckets)
+    static const uint32_t* getLatencyHistogram() { return m_latency_hist; }
 
     /// @brief Helper function for establishing MQTT connection with
     //  appropriate will topics
     static bool connectClientWithAvailability(PubSubClient& client, const char* id, const char* user, const char* password);
 
+    /// @brief As above, using the context's availability topic as the will, then
+    /// reporting every device on the same client as available. Their configs also
+    /// list the will topic, so they go offline with the connection.
+    static bool connectClientWithAvailability(ComponentContext& context, const char* id, const char* user, const char* password);
+
     /// @brief Callback for receiving MQTT messages
     static void onMessageReceived(char* topic, byte* payload, unsigned int length);
+
+private:
+    // Incremental config publishing state
+    static HACompItem* s_config_cursor;
+    static bool s_config_present;
+    static bool s_config_syncing;
+    static unsigned long s_config_sync_start;
+
+#if HA_CONFIG_CACHE_SIZE > 0
+    // Config payload cache
+    static uint8_t s_config_cache[HA_CONFIG_CACHE_SIZE];
+    static size_t s_config_cache_used;
+    static void buildConfigCache();
+#endif
+
+    // Rediscovery when HA comes online
+    static bool s_rediscover_on_birth;
+    static bool s_rediscover_pending;
+    static unsigned long s_rediscover_at;
+
+    // Reporting scheduler
+    static HATimer* s_wheel[HA_TIMER_WHEEL_SLOTS];
+    static unsigned long s_wheel_tick;
+    static bool s_scheduling;
+
+    static void insertTimer(HATimer& timer);
+    static void runScheduler(unsigned long now);
+
+    static uint32_t (*s_time_source)();
+
+#if HA_DEVICE_JSON_BUFFER_SIZE > 0
+    // Device discovery
+    enum class DeviceConfigResult { Published, TooLarge, Failed };
+    static bool s_device_discovery;
+    static ComponentContext* s_device_cursor;
+
+    static DeviceConfigResult publishDeviceConfig(ComponentContext& context, bool present);
+    static bool serviceDeviceConfigs(unsigned int max_messages);
+#endif
+
+    // Device registry
+    static ComponentContext* s_contexts;
+    static ComponentContext* s_loop_contexts;
+#ifdef HA_NO_HEAP
+    static ComponentContext* s_context_table[HA_CONTEXT_TABLE_SIZE];
+#else
+    static std::vector<ComponentContext*> s_context_table;
+#endif
+    static size_t s_context_table_size;
+
+    static void buildContexts();
+    static bool connectWithWill(HATransport& transport, HAAvailabilityComponent* avail, const char* id, const char* user, const char* password);
+
+    static void subscribeConfigs(bool subscribe);
+    static bool processRetainedConfig(const char* topic, const byte* payload, unsigned int length);
 };
 
 // Base class to get around templating quirks. Do not use directly.
@@ -143,7 +817,7 @@ protected:
     const char*     m_name;
     const char*     m_id;
     const char*     m_icon;
-    String          m_state_topic;
+    HATopic         m_state_topic;
     ComponentContext& context;
 
     static const char* m_component;
@@ -151,18 +825,32 @@ protected:
     virtual void getConfigInfo(JsonObject& json);
    // virtual String getStatusTopic();
 
+    ComponentContext& getContext() override { return context; }
+    void getConfigTopic(char* topic, size_t size) override;
+    const char* getPlatform() override { return m_component; }
+    const char* getId() override { return m_id; }
+    void buildConfig(JsonObject& json) override;
+
 public:
-    HACompBase(ComponentContext& context, const char* id, const char* name)
-        : m_id(id), m_name(name), context(context)
+    HACompBase(ComponentContext& context, const char* id, const char* name, const char* device_class = nullptr)
+        : m_device_class(device_class), m_name(name), m_id(id), m_icon(nullptr), context(context)
     {
-        m_components.push_back(this);
+        registerItem(this);
     }
 
     void initialize() override;
-    void publishConfig(bool present = true) override;
+    bool publishConfig(bool present = true) override;
 
-    void publishState(const char* value, bool retain = true);
-    void clearState();
+    /// @brief Publish to the state topic. Unless forced, a payload identical to the
+    /// last one published is skipped (see HAComponentManager::setStateRefresh)
+    bool publishState(const char* value, bool retain = true, bool force = false);
+    void clearState() override;
+
+protected:
+    // Last published state
+    uint32_t        m_state_hash = 0;
+    uint32_t        m_state_epoch = 0;
+    unsigned long   m_state_ts = 0;
 };
 
 // Generic Component
@@ -172,41 +860,318 @@ class HAComponent : public HACompBase<component>
     using HACompBase<component>::HACompBase; // constructor
 };
 
+// How sensor samples are combined over each reporting interval.
+// EMA and Percentile are only available when HA_SENSOR_EMA / HA_SENSOR_PERCENTILE
+// are defined, so sketches that don't need them don't pay for them.
+enum class SensorAggregation {
+    Mean,       // Arithmetic mean of the window (default)
+    Min,        // Smallest sample in the window
+    Max,        // Largest sample in the window
+    Last,       // Most recent sample
+    RMS,        // Root mean square of the window (eg. AC current)
+#ifdef HA_SENSOR_EMA
+    EMA,        // Exponential moving average, carried across windows
+#endif
+#ifdef HA_SENSOR_PERCENTILE
+    Percentile, // Streaming percentile estimate of the window (eg. 0.5 for median)
+#endif
+};
+
+#ifdef HA_SENSOR_PERCENTILE
+// Streaming quantile estimator using the P-Square algorithm
+// (Jain & Chlamtac 1985). O(1) per sample with five markers of state.
+class HAQuantileEstimator {
+    float m_p;
+    float m_q[5];   // Marker heights
+    float m_n[5];   // Marker positions
+    float m_np[5];  // Desired marker positions
+    float m_dn[5];  // Desired position increments
+    uint32_t m_count;
+
+public:
+    HAQuantileEstimator(float p = 0.5f) { reset(p); }
+
+    void reset(float p);
+    void reset() { reset(m_p); }
+    void add(float x);
+    float get() const;
+    uint32_t count() const { return m_count; }
+};
+#endif
+
+// Summary of a batch of samples (see HAComponent<Component::Sensor>::update)
+struct HASampleStats {
+    float sum;
+    float sum_sq;
+    float min;
+    float max;
+    float last;
+    uint32_t samples;
+};
+
+#ifdef HA_SENSOR_CONCURRENT
+// Busy-wait iterations before the concurrent window and spinlock yield() to
+// other tasks while waiting
+#ifndef HA_SPIN_YIELD_ITERATIONS
+#define HA_SPIN_YIELD_ITERATIONS (64)
+#endif
+
+// Sample window that can be updated from several threads/cores without locking.
+// Two banks are used: writers add to the active bank, and take() (single
+// consumer) switches banks, waits for writers still in the old one, then
+// reads and resets it.
+// The wait yields, which (as taskYIELD() on FreeRTOS) only lets tasks of the same
+// or higher priority run: a writer preempted on the consumer's core must not have
+// a lower priority than the task calling take(), and add() must not be called
+// from interrupts.
+class HAConcurrentWindow {
+    struct Bank {
+        std::atomic<float> sum;
+        std::atomic<float> min;
+        std::atomic<float> max;
+        std::atomic<float> last;
+        std::atomic<uint32_t> samples;
+        std::atomic<uint32_t> writers;
+    };
+    Bank m_banks[2];
+    std::atomic<uint8_t> m_active;
+
+    static void reset(Bank& bank);
+
+public:
+    HAConcurrentWindow();
+
+    void add(const HASampleStats& stats);
+    void add(float value) { add({ value, value * value, value, value, value, 1 }); }
+
+    /// @brief Combine the samples since the last call (Mean, Min, Max or Last)
+    /// @param count if not null, set to the number of samples combined
+    /// @return false if there were none
+    bool take(SensorAggregation mode, float& value, uint32_t* count = nullptr);
+};
+
+// Minimal spinlock, for state that can't be updated atomically.
+// Yields after HA_SPIN_YIELD_ITERATIONS, so the same priority requirement as for
+// HAConcurrentWindow applies: every task taking the lock on one core must have the
+// same priority, and it must not be taken from interrupts.
+class HASpinLock {
+    std::atomic_flag& m_flag;
+public:
+    HASpinLock(std::atomic_flag& flag) : m_flag(flag) {
+        for (uint32_t spins = 1; m_flag.test_and_set(std::memory_order_acquire); spins++) {
+            if (spins % HA_SPIN_YIELD_ITERATIONS == 0) {
+                yield();
+            }
+        }
+    }
+    ~HASpinLock() { m_flag.clear(std::memory_order_release); }
+};
+#endif
+
+// Group of sensors sharing a single JSON state topic (<device>/sensor/<id>/state).
+// Each member's discovery config extracts its own value with a value_template,
+// and the group is published as one message per scheduler tick.
+class HASensorGroup
+{
+    friend class HAComponentManager;
+    friend class HAComponent<Component::Sensor>;
+
+protected:
+    ComponentContext& context;
+    const char* m_id;
+    HATopic m_state_topic;
+    HAComponent<Component::Sensor>* m_members;
+    bool m_dirty;
+
+    HASensorGroup* m_next;
+    static HASensorGroup* s_groups;
+
+    void initialize();
+    void add(HAComponent<Component::Sensor>* sensor);
+    size_t printTo(Print& out);
+
+    static void flushAll();
+
+public:
+    HASensorGroup(ComponentContext& context, const char* id);
+
+    /// @brief Publish the latest value of every member
+    bool flush();
+};
+
+#if HA_OFFLINE_BUFFER_SIZE > 0
+// Fixed size ring buffer of sensor samples that could not be published.
+// When full, the oldest sample is dropped.
+class HAOfflineBuffer
+{
+public:
+    struct Sample {
+        HAComponent<Component::Sensor>* sensor;
+        uint32_t timestamp;
+        float value;
+    };
+
+    static void push(HAComponent<Component::Sensor>* sensor, uint32_t timestamp, float value);
+
+    /// @brief Publish up to max_samples buffered samples, stopping at the first failure
+    /// @return true if the buffer is now empty
+    static bool replay(unsigned int max_samples);
+
+    static size_t size() { return s_count; }
+    static uint32_t dropped() { return s_dropped; }
+
+private:
+    static Sample s_samples[HA_OFFLINE_BUFFER_SIZE];
+    static size_t s_head;
+    static size_t s_count;
+    static uint32_t s_dropped;
+};
+#endif
+
 // Specialization of Component of type Sensor
 template<>
 class HAComponent<Component::Sensor> : public HACompBase<Component::Sensor>
 {
+    friend class HASensorGroup;
+    friend class HAOfflineBuffer;
 protected:
     SensorClass m_sensor_class;
 
-    // Hysteresis
-    float m_hysteresis;
+    // Reporting policy (see setDeadband, setMaxSilence, setSwingingDoor)
+    float m_deadband;
+    bool m_deadband_percent;
+    unsigned long m_max_silence;
+    float m_sdt_tolerance;
+    float m_sdt_slope_upper;
+    float m_sdt_slope_lower;
+    bool m_sdt_open;
+
+    // Swinging door pivot (last archived point) and the latest point inside the door
+    float m_sdt_value;
+    unsigned long m_sdt_ts;
+    float m_sdt_prev_value;
+    unsigned long m_sdt_prev_ts;
+
+    // Last reported value
     float m_last_value;
+    unsigned long m_last_report_ts;
 
-    // Averaging
+    // Aggregation over the sample window
+    SensorAggregation m_aggregation;
     float m_sum;
+    float m_sum_sq;
     int m_samples;
+    float m_min;
+    float m_max;
+    float m_last;
+#ifdef HA_SENSOR_EMA
+    float m_ema_alpha;
+    float m_ema;
+    bool m_ema_valid;
+#endif
+#ifdef HA_SENSOR_PERCENTILE
+    HAQuantileEstimator m_quantile;
+#endif
+#ifdef HA_SENSOR_CONCURRENT
+    // Mean/Min/Max/Last are lock-free, the other modes take m_lock
+    HAConcurrentWindow m_window;
+    std::atomic_flag m_lock = ATOMIC_FLAG_INIT;
+#endif
 
     // Sampling
-    int m_last_ts;
-    int m_sample_interval;
+    HATimer m_timer;
+
+    // Number of decimal places to publish
+    uint8_t m_precision;
+
+    // Optional shared state topic
+    HASensorGroup* m_group;
+    HAComponent<Component::Sensor>* m_group_next;
+    bool m_reported;
 
     virtual void getConfigInfo(JsonObject& json);
 public:
     HAComponent(ComponentContext& context, const char* id, const char* name, int sample_interval_ms, float hysteresis = 0.0f, SensorClass sclass = SensorClass::Undefined, const char* icon = nullptr) :
         HACompBase(context, id, name),
-        m_sample_interval(sample_interval_ms),
         m_sensor_class(sclass),
-        m_hysteresis(hysteresis),
+        m_deadband(hysteresis),
+        m_deadband_percent(false),
+        m_max_silence(0),
+        m_sdt_tolerance(0.f),
+        m_sdt_open(false),
+        m_sdt_value(0.f),
+        m_sdt_ts(0),
+        m_sdt_prev_value(0.f),
+        m_sdt_prev_ts(0),
+        m_last_value(0.f),
+        m_last_report_ts(0),
+        m_aggregation(SensorAggregation::Mean),
         m_sum(0.f),
-        m_last_ts(0),
-        m_samples(0)
+        m_sum_sq(0.f),
+        m_samples(0),
+        m_timer(this, sample_interval_ms),
+        m_precision(2),
+        m_group(nullptr),
+        m_group_next(nullptr),
+        m_reported(false)
     { 
         m_icon = icon;
     }
 
+    /// @brief Report this sensor through a group's shared state topic.
+    /// Must be called before HAComponentManager::initializeAll().
+    void setGroup(HASensorGroup& group);
+
+    /// @brief Select how samples are combined into each reported value.
+    /// @param param EMA smoothing factor (0-1], or percentile (0-1) for Percentile
+    void setAggregation(SensorAggregation mode, float param = 0.5f);
+
+    /// @brief Only report values that differ from the last reported value by at least deadband
+    /// (or deadband percent of the last reported value). Replaces the constructor's hysteresis.
+    void setDeadband(float deadband, bool percent = false) { m_deadband = deadband; m_deadband_percent = percent; }
+
+    /// @brief Report at least every max_silence_ms even if the value is unchanged (0 to disable)
+    void setMaxSilence(unsigned long max_silence_ms) { m_max_silence = max_silence_ms; }
+
+    /// @brief Swinging door trending (0 to disable): when a straight line from the last reported
+    /// point can no longer represent every value since within tolerance, report the previous
+    /// value (moved onto the last line that fit, if needed) as the next point, so interpolating
+    /// between reported points is always within tolerance. A point is only known once a later
+    /// value no longer fits, so points are published one interval late, as {"val":<value>,"ts":<timestamp>} with their HAComponentManager::timestamp().
+    /// Takes precedence over the deadband. Set before the config is published.
+    void setSwingingDoor(float tolerance) { m_sdt_tolerance = tolerance; m_sdt_open = false; }
+
+    /// @brief Set the number of decimal places published (0-6, default 2).
+    /// Also advertised to HA as the suggested display precision.
+    void setPrecision(uint8_t precision) { m_precision = (precision > 6) ? 6 : precision; }
+
+    void initialize() override;
+
+    /// @brief Add a sample. With HA_SENSOR_CONCURRENT this may be called from any
+    /// thread, and values are only published from HAComponentManager::service().
     void update(float value);
+
+    /// @brief Add a batch of samples (eg. a DMA buffer), skipping non-finite values.
+    /// Cheaper per sample than update(float), the report interval is checked once.
+    void update(const float* samples, size_t count);
+
+    /// @brief Add a batch of raw ADC samples, each converted to raw * scale + offset
+    void update(const int16_t* samples, size_t count, float scale = 1.f, float offset = 0.f);
     float getCurrent();
+
+protected:
+    void onTimer(unsigned long now) override;
+    void flush(unsigned long now);
+    bool shouldReport(float& value, unsigned long& ts, unsigned long now);
+    bool swingDoor(float& value, unsigned long& ts, unsigned long now);
+    // Every report is sent (force_update), even when the value is unchanged
+    bool forceUpdate() const { return (m_deadband == 0.f && m_sdt_tolerance == 0.f) || m_max_silence > 0; }
+    bool publishHistory(uint32_t timestamp, float value);
+    void accumulate(float value);
+    void accumulate(const HASampleStats& stats);
+    bool isSequential() const;
+    bool aggregate(float& value);
+    void poll();
 };
 
 // Specialization of Component of type Switch
@@ -216,24 +1181,48 @@ class HAComponent<Component::Switch> : public HACompBase<Component::Switch>
     friend class HAComponentManager;
 protected:
     bool m_state;
-    String m_cmd_topic;
-    std::function<void(boolean)> m_callback;
+    HATopic m_cmd_topic;
+    HASwitchCallback m_callback;
+
+    // Command topic dispatch (hash table chained through m_hash_next)
+    uint32_t m_cmd_hash;
+    HAComponent<Component::Switch>* m_hash_next;
+    HAComponent<Component::Switch>* m_next_switch;
 
-    static std::vector<HAComponent<Component::Switch>*> m_switches;
+    static HAComponent<Component::Switch>* m_switches;
+    static size_t m_switch_count;
+#ifdef HA_NO_HEAP
+    static HAComponent<Component::Switch>* m_dispatch[HA_SWITCH_DISPATCH_SIZE];
+#else
+    static std::vector<HAComponent<Component::Switch>*> m_dispatch;
+#endif
+    static size_t m_dispatch_size;
+
+    HAEventQueue m_events;
 
     virtual void getConfigInfo(JsonObject& json);
+    void onEvent(bool state) override;
 public:
-    HAComponent(ComponentContext& context, const char* id, const char* name, std::function<void(boolean)> callback, const char* icon = nullptr);
+    HAComponent(ComponentContext& context, const char* id, const char* name, HASwitchCallback callback, const char* icon = nullptr);
 
     void initialize() override;
+    void onConfigPublished() override;
     void setState(bool state);
     void reportState();
 
+    /// @brief Report a state change made outside HA (eg. a push button toggling
+    /// the relay) from an interrupt. Published from service(), once
+    /// enableInterruptQueue() has been called. The callback isn't invoked.
+    void IRAM_ATTR reportStateFromISR(bool state);
+    void enableInterruptQueue() { m_events.enable(); }
+    uint32_t getInterruptOverflows() const { return m_events.getOverflows(); }
+
     static const char* ON;
     static const char* OFF;
 
 protected:
-    static void processMqttTopic(String& topic, String& payload);
+    static void buildDispatchTable();
+    static void processMqttTopic(const char* topic, const byte* payload, unsigned int length);
 };
 
 // Specialization of Component of type BinarySensor
@@ -242,17 +1231,29 @@ class HAComponent<Component::BinarySensor> : public HACompBase<Component::Binary
 {
 protected:
     BinarySensorClass m_sensor_class;
+    HAEventQueue m_events;
 
     virtual void getConfigInfo(JsonObject& json);
+    void onEvent(bool state) override { reportState(state); }
 public:
     HAComponent(ComponentContext& context, const char* id, const char* name, BinarySensorClass sensor_class = BinarySensorClass::Undefined, const char* icon = nullptr) :
         HACompBase(context, id, name),
-        m_sensor_class(sensor_class)
+        m_sensor_class(sensor_class),
+        m_events(this)
     {
         m_icon = icon;
     }
 
     void reportState(bool state);
+
+    /// @brief Report a state from an interrupt handler, eg. a door contact.
+    /// Published from service(), once enableInterruptQueue() has been called:
+    ///
+    ///     door.enableInterruptQueue();
+    ///     attachInterrupt(digitalPinToInterrupt(PIN), []() IRAM_ATTR { door.reportStateFromISR(digitalRead(PIN)); }, CHANGE);
+    void IRAM_ATTR reportStateFromISR(bool state) { m_events.push(state); }
+    void enableInterruptQueue() { m_events.enable(); }
+    uint32_t getInterruptOverflows() const { return m_events.getOverflows(); }
 };
 
 // Device availability component
@@ -266,10 +1267,83 @@ public:
     static const char* ONLINE;
     static const char* OFFLINE;
 
-    String getWillTopic();
+    const char* getWillTopic();
     void initialize() override;
     void connect();
 
     // Singleton
     static HAAvailabilityComponent* inst;
 };
+
+// Diagnostic sensor publishing the global performance counters every interval.
+// The state is the publish count, with all counters and the latency histogram as attributes.
+// Reporting is driven by HAComponentManager::service().
+class HAStatsComponent : public HACompBase<Component::Sensor>
+{
+protected:
+    HATimer m_timer;
+
+    virtual void getConfigInfo(JsonObject& json);
+    void onTimer(unsigned long now) override;
+    size_t printTo(Print& out);
+public:
+    HAStatsComponent(ComponentContext& context, unsigned long interval_ms = 60000, const char* id = "stats", const char* name = "Statistics");
+
+    void initialize() override;
+};
+
+// Pulse counter (eg. the pulse output of an energy or water meter).
+// Pulses are counted from an interrupt, and every interval the running total
+// (total_increasing) and the rate in units per hour are published together
+// as {"total":..,"rate":..}. Expose the rate as its own entity with HACounterRate.
+template<>
+class HAComponent<Component::Counter> : public HACompBase<Component::Counter>
+{
+protected:
+    std::atomic<uint32_t> m_pulses;
+    uint32_t m_reported_pulses;
+    uint64_t m_total_pulses;
+    float m_pulses_per_unit;
+    const char* m_unit;
+    uint8_t m_precision;
+    HATimer m_timer;
+    unsigned long m_last_ts;
+
+    virtual void getConfigInfo(JsonObject& json);
+    void onTimer(unsigned long now) override;
+public:
+    HAComponent(ComponentContext& context, const char* id, const char* name, unsigned long interval_ms,
+                float pulses_per_unit = 1.f, const char* unit = "", const char* device_class = nullptr, const char* icon = nullptr);
+
+    void initialize() override;
+
+    /// @brief Count pulses. Interrupt safe:
+    ///
+    ///     attachInterrupt(digitalPinToInterrupt(PIN), []() IRAM_ATTR { meter.increment(); }, FALLING);
+    void IRAM_ATTR increment(uint32_t count = 1) { m_pulses.fetch_add(count, std::memory_order_relaxed); }
+
+    /// @brief Total in units, as of the last report. As a float, this loses whole pulses above 2^24;
+    /// the published total is exact for a whole number of pulses per unit.
+    float getTotal() const { return (float)((double)m_total_pulses / m_pulses_per_unit); }
+
+    /// @brief Set the number of decimal places published (0-6, default 3)
+    void setPrecision(uint8_t precision) { m_precision = (precision > 6) ? 6 : precision; }
+};
+
+// Rate of an HAComponent<Component::Counter>, as a separate sensor entity
+// reading the counter's state topic. scale converts units per hour into
+// the rate's unit (eg. 1000 for kWh counted, W rate).
+class HACounterRate : public HACompBase<Component::Sensor>
+{
+protected:
+    const char* m_counter_id;
+    const char* m_unit;
+    float m_scale;
+
+    virtual void getConfigInfo(JsonObject& json);
+public:
+    HACounterRate(ComponentContext& context, const char* counter_id, const char* id, const char* name,
+                  const char* unit = "", float scale = 1.f, const char* device_class = nullptr, const char* icon = nullptr);
+
+    void initialize() override;
+};
@@ -0,0 +1,68 @@
+// Batch updates: sensor throughput adding samples one at a time with
+// update(float) against update(const float*, n) and the int16 ADC variant,
+// for a few batch lengths and aggregations. The sensor reports once per
+// simulated second, every 100 batches.
+
+#include "harness.h"
+#include <vector>
+
+PubSubClient client;
+ComponentContext context(client);
+HAComponent<Component::Sensor> sensor(context, "signal", "Signal", 1000);
+
+static const size_t SAMPLES = 4000000;
+
+static void report(const char* name, size_t batch, double ns_per_batch) {
+    double ns = ns_per_batch / batch;
+    printf("%-24s %8zu %12.2f %12.1f\n", name, batch, ns, 1000.0 / ns);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+    HAComponentManager::initializeAll();
+    client.setRecording(false);
+    client.connect("dev", nullptr, nullptr);
+
+    static const struct {
+        const char* name;
+        SensorAggregation mode;
+    } modes[] = {
+        { "Mean", SensorAggregation::Mean },
+        { "Max", SensorAggregation::Max },
+        { "RMS", SensorAggregation::RMS },
+    };
+
+    printf("%-24s %8s %12s %12s\n", "benchmark", "batch", "ns/sample", "Msamples/s");
+    for (const auto& mode : modes) {
+        sensor.setAggregation(mode.mode);
+        printf("%s\n", mode.name);
+        for (size_t batch : { 16, 256, 4096 }) {
+            // Noisy sine around 230, with a dropped (NaN) sample every 1000
+            std::vector<float> samples(batch);
+            std::vector<int16_t> raw(batch);
+            for (size_t i = 0; i < batch; i++) {
+                samples[i] = (i % 1000 == 999) ? NAN : 230.f + 10.f * sinf((float)i * 0.01f) + (float)(i % 7) * 0.1f;
+                raw[i] = (int16_t)((samples[i] == samples[i]) ? samples[i] * 100.f : 0.f);
+            }
+            size_t ops = SAMPLES / batch, calls = 0;
+
+            report("  update(float)", batch, harness::measure(client, ops, [&]() {
+                if (++calls % 100 == 0) advanceMillis(1000);
+                for (float x : samples) {
+                    sensor.update(x);
+                }
+            }).ns_per_op);
+            report("  update(float*, n)", batch, harness::measure(client, ops, [&]() {
+                if (++calls % 100 == 0) advanceMillis(1000);
+                sensor.update(samples.data(), batch);
+            }).ns_per_op);
+            report("  update(int16_t*, n)", batch, harness::measure(client, ops, [&]() {
+                if (++calls % 100 == 0) advanceMillis(1000);
+                sensor.update(raw.data(), batch, 0.01f);
+            }).ns_per_op);
+        }
+    }
+    return 0;
+}
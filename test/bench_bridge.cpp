@@ -0,0 +1,112 @@
+// Bridge at scale: discovery time and command latency with many devices of
+// 20 entities each (availability, 14 sensors, 5 switches) on one client.
+//
+//     bench_bridge [devices]     (default 1000, eg. 10000 for the full scale)
+
+#include "harness.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#define SENSORS_PER_DEVICE (14)
+#define SWITCHES_PER_DEVICE (5)
+
+PubSubClient client;
+
+static const char* const sensor_ids[SENSORS_PER_DEVICE] = {
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "s12", "s13"
+};
+static const char* const switch_ids[SWITCHES_PER_DEVICE] = { "w0", "w1", "w2", "w3", "w4" };
+
+struct Device {
+    std::string name;
+    ComponentContext context;
+    HAAvailabilityComponent availability;
+    std::vector<std::unique_ptr<HAComponent<Component::Sensor>>> sensors;
+    std::vector<std::unique_ptr<HAComponent<Component::Switch>>> switches;
+
+    Device(size_t i) : name("bridge" + std::to_string(i)), context(client), availability(context) {
+        context.mac_address = name.c_str();
+        context.device_name = name.c_str();
+        context.friendly_name = name.c_str();
+        for (const char* id : sensor_ids) {
+            sensors.emplace_back(new HAComponent<Component::Sensor>(context, id, id, 1000, 0.f, SensorClass::Temperature));
+        }
+        for (const char* id : switch_ids) {
+            switches.emplace_back(new HAComponent<Component::Switch>(context, id, id, [](bool) { }));
+        }
+    }
+};
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void reportTime(const char* name, double ms, size_t entities) {
+    printf("%-36s %12.1f ms %10.2f us/entity\n", name, ms, ms * 1000.0 / entities);
+}
+
+int main(int argc, char** argv) {
+    size_t count = (argc > 1) ? (size_t)atol(argv[1]) : 1000;
+    size_t entities = count * (1 + SENSORS_PER_DEVICE + SWITCHES_PER_DEVICE);
+    printf("%zu devices, %zu entities\n", count, entities);
+
+    std::vector<std::unique_ptr<Device>> devices;
+    for (size_t i = 0; i < count; i++) {
+        devices.emplace_back(new Device(i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    HAComponentManager::initializeAll();
+    reportTime("initializeAll", elapsedMs(start), entities);
+
+    client.setCallback(HAComponentManager::onMessageReceived);
+    client.setBufferSize(1024);
+    client.setRecording(false);
+
+    start = std::chrono::steady_clock::now();
+    HAComponentManager::connectClientWithAvailability(devices[0]->context, "bridge", nullptr, nullptr);
+    reportTime("connect (every device online)", elapsedMs(start), entities);
+
+    client.clear();
+    start = std::chrono::steady_clock::now();
+    HAComponentManager::publishConfigAll();
+    reportTime("publishConfigAll", elapsedMs(start), entities);
+    printf("%-36s %12u msgs %9.1f bytes/entity\n", "", client.published(), (double)client.publishedBytes() / entities);
+
+    // Incremental, as from loop(): a few configs per service() call
+    client.clear();
+    start = std::chrono::steady_clock::now();
+    HAComponentManager::requestConfigAll();
+    size_t calls = 1;
+    while (!HAComponentManager::service(16)) {
+        calls++;
+    }
+    reportTime("requestConfigAll + service(16)", elapsedMs(start), entities);
+    printf("%-36s %12zu calls\n", "", calls);
+
+    // Command to state report, on switches spread across every device
+    const size_t commands = 100000;
+    std::vector<std::string> topics;
+    for (size_t i = 0; i < 1024 && i < count * SWITCHES_PER_DEVICE; i++) {
+        size_t device = (i * 7919) % count;
+        topics.push_back(devices[device]->name + "/switch/" + switch_ids[(i / count) % SWITCHES_PER_DEVICE] + "/ctrl");
+    }
+    std::vector<double> latency;
+    latency.reserve(commands);
+    client.clear();
+    size_t allocs = harness::allocations();
+    for (size_t i = 0; i < commands; i++) {
+        const std::string& topic = topics[i % topics.size()];
+        const char* payload = ((i / topics.size()) & 1) ? "OFF" : "ON";
+        auto t0 = std::chrono::steady_clock::now();
+        client.deliver(topic.c_str(), payload);
+        latency.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count());
+    }
+    size_t states = client.published();
+    std::sort(latency.begin(), latency.end());
+    printf("%-36s %8.0f ns p50 %8.0f ns p99 %8.0f ns max\n", "command latency",
+        latency[commands / 2], latency[commands * 99 / 100], latency.back());
+    printf("%-36s %12zu states %7.2f allocs/cmd\n", "", states, (double)(harness::allocations() - allocs) / commands);
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Cost of the main entry points as the number of registered components grows.
+// Components are 3/4 sensors and 1/4 switches, all on one device.
+
+#include "harness.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+PubSubClient client;
+ComponentContext context(client);
+
+static std::deque<std::string> ids;
+static std::vector<std::unique_ptr<HAComponent<Component::Sensor>>> sensors;
+static std::vector<std::unique_ptr<HAComponent<Component::Switch>>> switches;
+static std::vector<std::string> command_topics;
+
+static void addComponents(size_t total) {
+    while (sensors.size() + switches.size() < total) {
+        size_t i = sensors.size() + switches.size();
+        ids.push_back("c" + std::to_string(i));
+        const char* id = ids.back().c_str();
+        if (i % 4 == 3) {
+            switches.emplace_back(new HAComponent<Component::Switch>(context, id, id, [](bool) { }));
+            command_topics.push_back("bench/switch/" + ids.back() + "/ctrl");
+        } else {
+            sensors.emplace_back(new HAComponent<Component::Sensor>(context, id, id, 1000, 0.f, SensorClass::Temperature));
+        }
+    }
+    HAComponentManager::initializeAll();
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "bench";
+    context.friendly_name = "Bench";
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+
+    client.setCallback(HAComponentManager::onMessageReceived);
+    client.connect("bench", nullptr, nullptr);
+    client.setRecording(false);
+
+    for (size_t n : { 10, 100, 1000 }) {
+        addComponents(n);
+
+        // One sample per simulated millisecond, so a report every 1000 calls
+        HAComponent<Component::Sensor>& sensor = *sensors.front();
+        float value = 0.f;
+        harness::report("Sensor::update", n, harness::measure(client, 200000, [&]() {
+            advanceMillis(1);
+            sensor.update(value += 0.01f);
+        }));
+
+        harness::report("HACompBase::publishConfig", n, harness::measure(client, 20000, [&]() {
+            sensor.publishConfig();
+        }));
+
+        harness::report("publishConfigAll", n, harness::measure(client, 20000 / n, []() {
+            HAComponentManager::publishConfigAll();
+        }));
+
+        // Alternate ON/OFF across every switch, so each command changes the state
+        size_t i = 0;
+        harness::report("onMessageReceived", n, harness::measure(client, 100000, [&]() {
+            const std::string& topic = command_topics[i % command_topics.size()];
+            client.deliver(topic.c_str(), ((i / command_topics.size()) & 1) ? "OFF" : "ON");
+            i++;
+        }));
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+// HA_SENSOR_CONCURRENT: throughput of HAConcurrentWindow::add() from
+// several threads, against the same window behind a spinlock and a mutex,
+// while a consumer takes a window every millisecond.
+
+#include "harness.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef HA_SENSOR_CONCURRENT
+#error "Build with HA_SENSOR_CONCURRENT"
+#endif
+
+#define SAMPLES_PER_THREAD (1000000)
+
+// Plain window, for the locked baselines
+struct Window {
+    float sum = 0.f;
+    uint32_t samples = 0;
+    void add(float value) { sum += value; samples++; }
+};
+
+template<typename Add, typename Take>
+static double run(int threads, Add add, Take take) {
+    std::atomic<bool> done(false);
+    std::thread consumer([&]() {
+        while (!done) {
+            take();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; t++) {
+        writers.emplace_back([&]() {
+            for (int i = 0; i < SAMPLES_PER_THREAD; i++) {
+                add(1.f);
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    done = true;
+    consumer.join();
+    return std::chrono::duration<double, std::nano>(end - start).count() / ((double)threads * SAMPLES_PER_THREAD);
+}
+
+static void report(const char* name, int threads, double ns) {
+    printf("%-28s %8d %12.1f %12.1f\n", name, threads, ns, 1000.0 / ns);
+}
+
+int main() {
+    printf("%-28s %8s %12s %12s\n", "benchmark", "threads", "ns/sample", "Msamples/s");
+    for (int threads : { 1, 2, 4 }) {
+        HAConcurrentWindow window;
+        report("HAConcurrentWindow::add", threads, run(threads,
+            [&](float value) { window.add(value); },
+            [&]() { float value; window.take(SensorAggregation::Mean, value); }));
+
+        Window spin_window;
+        std::atomic_flag flag = ATOMIC_FLAG_INIT;
+        report("HASpinLock + add", threads, run(threads,
+            [&](float value) { HASpinLock lock(flag); spin_window.add(value); },
+            [&]() { HASpinLock lock(flag); spin_window = Window(); }));
+
+        Window mutex_window;
+        std::mutex mutex;
+        report("std::mutex + add", threads, run(threads,
+            [&](float value) { std::lock_guard<std::mutex> lock(mutex); mutex_window.add(value); },
+            [&]() { std::lock_guard<std::mutex> lock(mutex); mutex_window = Window(); }));
+    }
+    printf("(%u hardware threads)\n", std::thread::hardware_concurrency());
+    return 0;
+}
@@ -0,0 +1,60 @@
+// Config publishing with and without the config cache: built as
+// bench_config_cache (HA_CONFIG_CACHE_SIZE=65536) and bench_config_nocache
+// (HA_CONFIG_CACHE_SIZE=0) from this file. 100 components of one device,
+// 3/4 sensors and 1/4 switches.
+
+#include "harness.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+#define COMPONENTS (100)
+
+PubSubClient client;
+ComponentContext context(client);
+
+#if HA_CONFIG_CACHE_SIZE > 0
+#define VARIANT " (cache)"
+#else
+#define VARIANT " (no cache)"
+#endif
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "bench";
+    context.friendly_name = "Bench";
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+
+    std::deque<std::string> ids;
+    std::vector<std::unique_ptr<HAComponent<Component::Sensor>>> sensors;
+    std::vector<std::unique_ptr<HAComponent<Component::Switch>>> switches;
+    for (size_t i = 0; i < COMPONENTS; i++) {
+        ids.push_back("c" + std::to_string(i));
+        const char* id = ids.back().c_str();
+        if (i % 4 == 3) {
+            switches.emplace_back(new HAComponent<Component::Switch>(context, id, id, [](bool) { }));
+        } else {
+            sensors.emplace_back(new HAComponent<Component::Sensor>(context, id, id, 1000, 0.f, SensorClass::Temperature));
+        }
+    }
+    HAComponentManager::initializeAll();
+#if HA_CONFIG_CACHE_SIZE > 0
+    printf("config cache: %zu of %u bytes\n", HAComponentManager::getConfigCacheUsed(), (unsigned)HA_CONFIG_CACHE_SIZE);
+#endif
+
+    client.connect("bench", nullptr, nullptr);
+    client.setRecording(false);
+
+    harness::report("Sensor::publishConfig" VARIANT, COMPONENTS, harness::measure(client, 50000, [&]() {
+        sensors.front()->publishConfig();
+    }));
+    harness::report("Switch::publishConfig" VARIANT, COMPONENTS, harness::measure(client, 50000, [&]() {
+        switches.front()->publishConfig();
+    }));
+    harness::report("publishConfigAll" VARIANT, COMPONENTS, harness::measure(client, 500, []() {
+        HAComponentManager::publishConfigAll();
+    }));
+    return 0;
+}
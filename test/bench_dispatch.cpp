@@ -0,0 +1,47 @@
+// Command dispatch cost should not depend on the number of switches.
+
+#include "harness.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+PubSubClient client;
+ComponentContext context(client);
+
+static std::deque<std::string> ids;
+static std::vector<std::unique_ptr<HAComponent<Component::Switch>>> switches;
+static std::vector<std::string> topics;
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "bench";
+    context.friendly_name = "Bench";
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+
+    client.setCallback(HAComponentManager::onMessageReceived);
+    client.connect("bench", nullptr, nullptr);
+    client.setRecording(false);
+
+    for (size_t n : { 1, 10, 100, 1000 }) {
+        while (switches.size() < n) {
+            ids.push_back("relay" + std::to_string(switches.size()));
+            switches.emplace_back(new HAComponent<Component::Switch>(context, ids.back().c_str(), "Relay", [](bool) { }));
+            topics.push_back("bench/switch/" + ids.back() + "/ctrl");
+        }
+        HAComponentManager::initializeAll();
+
+        // Alternate ON/OFF across every switch, so each command changes the state
+        size_t i = 0;
+        harness::report("dispatch (hit)", n, harness::measure(client, 200000, [&]() {
+            client.deliver(topics[i % n].c_str(), ((i / n) & 1) ? "OFF" : "ON");
+            i++;
+        }));
+
+        harness::report("dispatch (miss)", n, harness::measure(client, 200000, []() {
+            client.deliver("bench/switch/unknown/ctrl", "ON");
+        }));
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Reporting policies on deterministic synthetic traces (one sample per 1 s
+// interval): messages published, and how far the value seen by a subscriber
+// is from the samples. Deadband reports are held until the next one, swinging
+// door points are interpolated, up to the last one: "pending" is the samples
+// at the end not covered by a point yet (the door is still open).
+
+#include "harness.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+PubSubClient client;
+ComponentContext context(client);
+
+static const int SAMPLES = 20000;
+
+struct Trace {
+    const char* name;
+    std::vector<float> values;
+};
+
+struct Policy {
+    const char* name;
+    float deadband;
+    bool percent;
+    float sdt_tolerance;
+};
+
+struct Run {
+    const Trace* trace;
+    const Policy* policy;
+    std::string topic;
+    std::unique_ptr<HAComponent<Component::Sensor>> sensor;
+    std::vector<std::pair<double, double>> points;  // (timestamp, value) as received
+};
+
+// Deterministic uniform noise in [-1, 1]
+static float noise() {
+    static uint32_t state = 12345;
+    state = state * 1664525u + 1013904223u;
+    return (float)(state >> 8) / (float)(1u << 23) - 1.f;
+}
+
+static std::vector<Trace> makeTraces() {
+    std::vector<Trace> traces(3);
+    traces[0].name = "temperature";   // Slow random walk with sensor noise
+    traces[1].name = "daily";         // Hourly sine with noise
+    traces[2].name = "thermostat";    // Heating ramps and cooling steps
+    float walk = 20.f;
+    for (int i = 0; i < SAMPLES; i++) {
+        walk += 0.03f * noise();
+        traces[0].values.push_back(walk + 0.05f * noise());
+        traces[1].values.push_back(20.f + 5.f * sinf(i * 2.f * (float)M_PI / 3600.f) + 0.05f * noise());
+        int phase = i % 1200;
+        traces[2].values.push_back(phase < 900 ? 18.f + phase * 0.004f : 18.f);
+    }
+    return traces;
+}
+
+static const Policy policies[] = {
+    { "every sample",  0.f,  false, 0.f  },
+    { "deadband 0.2",  0.2f, false, 0.f  },
+    { "deadband 2%",   2.f,  true,  0.f  },
+    { "swinging door 0.2", 0.f, false, 0.2f },
+    { "swinging door 0.5", 0.f, false, 0.5f },
+};
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "bench";
+    context.friendly_name = "Bench";
+
+    std::vector<Trace> traces = makeTraces();
+    std::deque<std::string> ids;
+    std::vector<Run> runs;
+    for (const Trace& trace : traces) {
+        for (const Policy& policy : policies) {
+            ids.push_back("s" + std::to_string(runs.size()));
+            const char* id = ids.back().c_str();
+            Run run;
+            run.trace = &trace;
+            run.policy = &policy;
+            run.topic = "bench/sensor/" + ids.back() + "/state";
+            run.sensor.reset(new HAComponent<Component::Sensor>(context, id, id, 1000));
+            run.sensor->setDeadband(policy.deadband, policy.percent);
+            run.sensor->setSwingingDoor(policy.sdt_tolerance);
+            runs.push_back(std::move(run));
+        }
+    }
+    HAComponentManager::initializeAll();
+    client.connect("bench", nullptr, nullptr);
+
+    // Sample mid-interval, so every update() is past the next deadline
+    setMillis(500);
+    for (int i = 0; i < SAMPLES; i++) {
+        advanceMillis(1000);
+        double now = (double)HAComponentManager::timestamp();
+        client.clear();
+        for (Run& run : runs) {
+            run.sensor->update(run.trace->values[i]);
+        }
+        for (size_t m = 0; m < client.count(); m++) {
+            for (Run& run : runs) {
+                if (client[m].is(run.topic.c_str())) {
+                    std::string payload = harness::payload(client[m]);
+                    double ts = now, value;
+                    if (sscanf(payload.c_str(), "{\"val\":%lf,\"ts\":%lf}", &value, &ts) != 2) {
+                        value = atof(payload.c_str());
+                    }
+                    run.points.push_back(std::make_pair(ts, value));
+                }
+            }
+        }
+    }
+
+    printf("%-12s %-18s %10s %10s %10s %10s %8s\n", "trace", "policy", "messages", "reduction", "max error", "rms error", "pending");
+    for (const Run& run : runs) {
+        bool interpolate = run.policy->sdt_tolerance > 0.f;
+        double max_error = 0.0, sum_sq = 0.0;
+        size_t count = 0, segment = 0;
+        for (int i = 0; i < SAMPLES; i++) {
+            double ts = 1.0 + i;
+            if (interpolate && ts > run.points.back().first) {
+                break;
+            }
+            while (segment + 1 < run.points.size() && ts >= run.points[segment + 1].first) {
+                segment++;
+            }
+            double estimate = run.points[segment].second;
+            if (interpolate && ts > run.points[segment].first) {
+                const auto& a = run.points[segment];
+                const auto& b = run.points[segment + 1];
+                estimate = a.second + (b.second - a.second) * (ts - a.first) / (b.first - a.first);
+            }
+            double error = fabs(estimate - run.trace->values[i]);
+            max_error = std::max(max_error, error);
+            sum_sq += error * error;
+            count++;
+        }
+        printf("%-12s %-18s %10zu %9.1f%% %10.3f %10.3f %8zu\n",
+            run.trace->name, run.policy->name, run.points.size(),
+            100.0 * (1.0 - (double)run.points.size() / SAMPLES),
+            max_error, sqrt(sum_sq / count), SAMPLES - count);
+    }
+    return 0;
+}
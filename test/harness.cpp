@@ -0,0 +1,86 @@
+#include "harness.h"
+#include <atomic>
+#include <new>
+
+// Library log output, only shown with HA_TEST_VERBOSE set
+class TestDebug : public Stream {
+public:
+    size_t write(uint8_t c) override {
+        static bool verbose = getenv("HA_TEST_VERBOSE") != nullptr;
+        if (verbose) {
+            fputc(c, stderr);
+        }
+        return 1;
+    }
+};
+
+static TestDebug s_debug;
+Stream& Debug = s_debug;
+
+static std::atomic<size_t> s_allocations(0);
+static int s_checks_failed = 0;
+
+void* operator new(size_t size) {
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace harness {
+
+size_t allocations() {
+    return s_allocations.load(std::memory_order_relaxed);
+}
+
+void fail(const char* file, int line, const char* expr, const std::string& detail) {
+    s_checks_failed++;
+    fprintf(stderr, "%s:%d: CHECK(%s) failed", file, line, expr);
+    if (!detail.empty()) {
+        fprintf(stderr, ": %s", detail.c_str());
+    }
+    fprintf(stderr, "\n");
+}
+
+int finish() {
+    if (s_checks_failed > 0) {
+        fprintf(stderr, "%d check(s) failed\n", s_checks_failed);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
+
+void report(const char* name, size_t components, const Result& result) {
+    static bool header = false;
+    if (!header) {
+        printf("%-36s %10s %12s %12s %10s\n", "benchmark", "components", "ns/op", "bytes/op", "allocs/op");
+        header = true;
+    }
+    printf("%-36s %10zu %12.1f %12.1f %10.2f\n",
+        name, components, result.ns_per_op, result.bytes_per_op, result.allocs_per_op);
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+// Minimal test and benchmark helpers for the host build.
+// Each test is its own executable (the component registry is process-wide),
+// defining its components as globals like a sketch would.
+
+#include <hacomponent.h>
+#include <string>
+#include <chrono>
+
+namespace harness {
+
+/// Heap allocations (operator new) since startup, from all threads
+size_t allocations();
+
+void fail(const char* file, int line, const char* expr, const std::string& detail = std::string());
+
+/// Print a summary, the return value is the process exit code
+int finish();
+
+inline std::string payload(const PubSubClient::Message& message) {
+    return std::string((const char*)message.payload, message.length);
+}
+
+// Benchmarks
+
+struct Result {
+    double ns_per_op;
+    double bytes_per_op;
+    double allocs_per_op;
+};
+
+/// Time ops calls of fn (after one warm-up call), counting the bytes
+/// published through client and heap allocations
+template<typename F>
+Result measure(PubSubClient& client, size_t ops, F fn) {
+    fn();
+
+    client.clear();
+    size_t allocs = allocations();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    Result result;
+    result.ns_per_op = std::chrono::duration<double, std::nano>(end - start).count() / ops;
+    result.bytes_per_op = (double)client.publishedBytes() / ops;
+    result.allocs_per_op = (double)(allocations() - allocs) / ops;
+    return result;
+}
+
+/// One line per result, with a header before the first
+void report(const char* name, size_t components, const Result& result);
+
+}
+
+#define CHECK(cond) \
+    do { if (!(cond)) harness::fail(__FILE__, __LINE__, #cond); } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        auto _a = (actual); auto _e = (expected); \
+        if (!(_a == _e)) harness::fail(__FILE__, __LINE__, #actual " == " #expected, \
+                                       "got " + std::to_string(_a) + ", expected " + std::to_string(_e)); \
+    } while (0)
+
+#define CHECK_STR(actual, expected) \
+    do { \
+        std::string _a = (actual); std::string _e = (expected); \
+        if (_a != _e) harness::fail(__FILE__, __LINE__, #actual " == " #expected, \
+                                    "got \"" + _a + "\", expected \"" + _e + "\""); \
+    } while (0)
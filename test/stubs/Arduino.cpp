@@ -0,0 +1,113 @@
+#include <Arduino.h>
+#include <thread>
+
+static unsigned long s_millis = 0;
+
+unsigned long millis() {
+    return s_millis;
+}
+
+unsigned long micros() {
+    return s_millis * 1000UL;
+}
+
+void setMillis(unsigned long ms) {
+    s_millis = ms;
+}
+
+void advanceMillis(unsigned long ms) {
+    s_millis += ms;
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+// Deterministic, so test runs are repeatable
+static unsigned long s_random = 1;
+
+void randomSeed(unsigned long seed) {
+    s_random = seed;
+}
+
+long random(long max) {
+    if (max <= 0) {
+        return 0;
+    }
+    s_random = s_random * 1103515245UL + 12345UL;
+    return (long)((s_random >> 16) % (unsigned long)max);
+}
+
+long random(long min, long max) {
+    return (max > min) ? min + random(max - min) : min;
+}
+
+char* dtostrf(double value, signed char width, unsigned char precision, char* buf) {
+    sprintf(buf, "%*.*f", width, precision, value);
+    return buf;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(long value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    return write(buf);
+}
+
+size_t Print::print(unsigned long value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lu", value);
+    return write(buf);
+}
+
+size_t Print::print(double value, int digits) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    return write(buf);
+}
+
+void String::reserve(unsigned int size) {
+    if (size + 1 <= m_cap) {
+        return;
+    }
+    char* buf = new char[size + 1];
+    memcpy(buf, (m_buf != nullptr) ? m_buf : "", m_len + 1);
+    delete[] m_buf;
+    m_buf = buf;
+    m_cap = size + 1;
+}
+
+void String::assign(const char* str, size_t length) {
+    // str may point into our own buffer
+    char* buf = (length + 1 <= m_cap) ? m_buf : new char[length + 1];
+    memmove(buf, str, length);
+    buf[length] = '\0';
+    if (buf != m_buf) {
+        delete[] m_buf;
+        m_buf = buf;
+        m_cap = length + 1;
+    }
+    m_len = length;
+}
+
+void String::append(const char* str, size_t length) {
+    if (m_len + length + 1 > m_cap) {
+        char* buf = new char[m_len + length + 1];
+        memcpy(buf, m_buf, m_len);
+        memcpy(buf + m_len, str, length);
+        delete[] m_buf;
+        m_buf = buf;
+        m_cap = m_len + length + 1;
+    } else {
+        memmove(m_buf + m_len, str, length);
+    }
+    m_len += length;
+    m_buf[m_len] = '\0';
+}
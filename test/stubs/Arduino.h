@@ -0,0 +1,115 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core used by hacomponent.
+// millis()/micros() are a simulated clock driven by the tests.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Flash (PROGMEM) is ordinary memory on the host
+class __FlashStringHelper;
+#define PROGMEM
+#define PSTR(s)             (s)
+#define FPSTR(p)            (reinterpret_cast<const __FlashStringHelper*>(p))
+#define F(s)                FPSTR(PSTR(s))
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define strlen_P            strlen
+#define memcpy_P            memcpy
+#define strcmp_P            strcmp
+
+// Simulated clock
+unsigned long millis();
+unsigned long micros();
+void setMillis(unsigned long ms);
+void advanceMillis(unsigned long ms);
+
+// Lets other threads run (the host scheduler's, for the concurrency tests)
+void yield();
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+char* dtostrf(double value, signed char width, unsigned char precision, char* buf);
+
+class String;
+
+class Print {
+public:
+    virtual ~Print() { }
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+
+    size_t write(const char* str) { return (str != nullptr) ? write((const uint8_t*)str, strlen(str)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+    size_t print(const char* str) { return write(str); }
+    size_t print(const __FlashStringHelper* str) { return write((const char*)str); }
+    size_t print(const String& str);
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value) { return print((long)value); }
+    size_t print(unsigned int value) { return print((unsigned long)value); }
+    size_t print(long value);
+    size_t print(unsigned long value);
+    size_t print(double value, int digits = 2);
+
+    template<typename T>
+    size_t println(T value) { return print(value) + println(); }
+    size_t println() { return write("\r\n"); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+};
+
+// Heap allocated, like the Arduino String, so allocations show up in the counters
+class String {
+public:
+    String(const char* str = "") { assign(str, strlen(str)); }
+    String(const String& other) { assign(other.m_buf, other.m_len); }
+    ~String() { delete[] m_buf; }
+
+    String& operator=(const String& other) {
+        if (this != &other) {
+            assign(other.m_buf, other.m_len);
+        }
+        return *this;
+    }
+    String& operator=(const char* str) { assign(str, strlen(str)); return *this; }
+
+    bool operator==(const String& other) const { return m_len == other.m_len && memcmp(m_buf, other.m_buf, m_len) == 0; }
+    bool operator==(const char* str) const { return strcmp(m_buf, str) == 0; }
+    bool operator!=(const String& other) const { return !(*this == other); }
+
+    String& operator+=(const char* str) { append(str, strlen(str)); return *this; }
+    String& operator+=(const String& other) { append(other.m_buf, other.m_len); return *this; }
+    String& operator+=(char c) { append(&c, 1); return *this; }
+
+    bool equalsIgnoreCase(const String& other) const { return strcasecmp(m_buf, other.m_buf) == 0; }
+    void reserve(unsigned int size);
+
+    const char* c_str() const { return m_buf; }
+    unsigned int length() const { return m_len; }
+
+private:
+    char* m_buf = nullptr;
+    unsigned int m_len = 0;
+    unsigned int m_cap = 0;
+
+    void assign(const char* str, size_t length);
+    void append(const char* str, size_t length);
+};
+
+inline size_t Print::print(const String& str) { return write((const uint8_t*)str.c_str(), str.length()); }
@@ -0,0 +1,308 @@
+#include <ArduinoJson.h>
+#include <new>
+
+void* JsonBuffer::alloc(size_t bytes) {
+    size_t start = (m_size + 7) & ~(size_t)7;
+    if (start > m_capacity || bytes > m_capacity - start) {
+        return nullptr;
+    }
+    m_size = start + bytes;
+    return &m_buffer[start];
+}
+
+const char* JsonBuffer::strdup(const char* str, size_t length) {
+    char* copy = (char*)alloc(length + 1);
+    if (copy != nullptr) {
+        memcpy(copy, str, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+JsonObject& JsonBuffer::createObject() {
+    void* p = alloc(sizeof(JsonObject));
+    if (p == nullptr) {
+        return JsonObject::invalid();
+    }
+    return *new (p) JsonObject(this);
+}
+
+JsonObject& JsonObject::invalid() {
+    static JsonObject object(nullptr);
+    return object;
+}
+
+// Find the member for key, appending it if new
+JsonVariant* JsonObject::slot(const char* key) {
+    if (m_buffer == nullptr) {
+        return nullptr;
+    }
+    for (Node* node = m_first; node != nullptr; node = node->next) {
+        if (strcmp(node->key, key) == 0) {
+            return &node->value;
+        }
+    }
+
+    void* p = m_buffer->alloc(sizeof(Node));
+    if (p == nullptr) {
+        return nullptr;
+    }
+    Node* node = new (p) Node();
+    node->key = key;
+    node->next = nullptr;
+    if (m_last != nullptr) {
+        m_last->next = node;
+    } else {
+        m_first = node;
+    }
+    m_last = node;
+    return &node->value;
+}
+
+bool JsonObject::set(const char* key, const char* value) {
+    JsonVariant* v = slot(key);
+    if (v == nullptr) {
+        return false;
+    }
+    v->type = (value != nullptr) ? JsonVariant::Type::String : JsonVariant::Type::Null;
+    v->string = value;
+    return true;
+}
+
+bool JsonObject::setCopy(const char* key, const char* value, size_t length, bool null) {
+    if (null) {
+        return set(key, (const char*)nullptr);
+    }
+    JsonVariant* v = slot(key);
+    if (v == nullptr) {
+        return false;
+    }
+    const char* copy = m_buffer->strdup(value, length);
+    if (copy == nullptr) {
+        // The member stays, without a value (as ArduinoJson does)
+        v->type = JsonVariant::Type::Null;
+        return false;
+    }
+    v->type = JsonVariant::Type::String;
+    v->string = copy;
+    return true;
+}
+
+bool JsonObject::set(const char* key, bool value) {
+    JsonVariant* v = slot(key);
+    if (v == nullptr) {
+        return false;
+    }
+    v->type = JsonVariant::Type::Bool;
+    v->boolean = value;
+    return true;
+}
+
+bool JsonObject::setNumber(const char* key, JsonVariant::Type type, long long value) {
+    JsonVariant* v = slot(key);
+    if (v == nullptr) {
+        return false;
+    }
+    v->type = type;
+    v->integer = value;
+    return true;
+}
+
+JsonObject& JsonObject::createNestedObject(const char* key) {
+    if (m_buffer == nullptr) {
+        return invalid();
+    }
+    JsonObject& object = m_buffer->createObject();
+    if (!object.success()) {
+        return object;
+    }
+    JsonVariant* v = slot(key);
+    if (v == nullptr) {
+        return invalid();
+    }
+    v->type = JsonVariant::Type::Object;
+    v->object = &object;
+    return object;
+}
+
+JsonArray& JsonObject::createNestedArray(const char* key) {
+    if (m_buffer == nullptr) {
+        return JsonArray::invalid();
+    }
+    void* p = m_buffer->alloc(sizeof(JsonArray));
+    if (p == nullptr) {
+        return JsonArray::invalid();
+    }
+    JsonArray& array = *new (p) JsonArray(m_buffer);
+    JsonVariant* v = slot(key);
+    if (v == nullptr) {
+        return JsonArray::invalid();
+    }
+    v->type = JsonVariant::Type::Array;
+    v->array = &array;
+    return array;
+}
+
+JsonArray& JsonArray::invalid() {
+    static JsonArray array(nullptr);
+    return array;
+}
+
+JsonObject& JsonArray::createNestedObject() {
+    if (m_buffer == nullptr) {
+        return JsonObject::invalid();
+    }
+    JsonObject& object = m_buffer->createObject();
+    if (!object.success()) {
+        return object;
+    }
+    void* p = m_buffer->alloc(sizeof(Node));
+    if (p == nullptr) {
+        return JsonObject::invalid();
+    }
+    Node* node = new (p) Node();
+    node->object = &object;
+    node->next = nullptr;
+    if (m_last != nullptr) {
+        m_last->next = node;
+    } else {
+        m_first = node;
+    }
+    m_last = node;
+    return object;
+}
+
+size_t JsonArray::size() const {
+    size_t n = 0;
+    for (Node* node = m_first; node != nullptr; node = node->next) {
+        n++;
+    }
+    return n;
+}
+
+size_t JsonArray::printTo(Print& out) const {
+    size_t n = out.print('[');
+    for (Node* node = m_first; node != nullptr; node = node->next) {
+        if (node != m_first) {
+            n += out.print(',');
+        }
+        n += node->object->printTo(out);
+    }
+    n += out.print(']');
+    return n;
+}
+
+size_t JsonObject::size() const {
+    size_t n = 0;
+    for (Node* node = m_first; node != nullptr; node = node->next) {
+        n++;
+    }
+    return n;
+}
+
+// Write a quoted string, passing runs of plain characters in one write
+size_t JsonObject::printString(Print& out, const char* str) {
+    size_t n = out.print('"');
+    const char* run = str;
+    for (; *str != '\0'; str++) {
+        const char* escape = nullptr;
+        switch (*str) {
+            case '"':  escape = "\\\""; break;
+            case '\\': escape = "\\\\"; break;
+            case '\b': escape = "\\b"; break;
+            case '\f': escape = "\\f"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            case '\t': escape = "\\t"; break;
+        }
+        if (escape != nullptr) {
+            n += out.write((const uint8_t*)run, str - run);
+            n += out.write(escape);
+            run = str + 1;
+        }
+    }
+    n += out.write((const uint8_t*)run, str - run);
+    n += out.print('"');
+    return n;
+}
+
+size_t JsonObject::printVariant(Print& out, const JsonVariant& value) {
+    char buf[32];
+    switch (value.type) {
+        case JsonVariant::Type::String:
+            return printString(out, value.string);
+        case JsonVariant::Type::Bool:
+            return out.write(value.boolean ? "true" : "false");
+        case JsonVariant::Type::Integer:
+            snprintf(buf, sizeof(buf), "%lld", value.integer);
+            return out.write(buf);
+        case JsonVariant::Type::Unsigned:
+            snprintf(buf, sizeof(buf), "%llu", value.uinteger);
+            return out.write(buf);
+        case JsonVariant::Type::Float:
+            snprintf(buf, sizeof(buf), "%.9g", value.number);
+            return out.write(buf);
+        case JsonVariant::Type::Object:
+            return value.object->printTo(out);
+        case JsonVariant::Type::Array:
+            return value.array->printTo(out);
+        case JsonVariant::Type::Null:
+        default:
+            return out.write("null");
+    }
+}
+
+size_t JsonObject::printTo(Print& out) const {
+    size_t n = out.print('{');
+    for (Node* node = m_first; node != nullptr; node = node->next) {
+        if (node != m_first) {
+            n += out.print(',');
+        }
+        n += printString(out, node->key);
+        n += out.print(':');
+        n += printVariant(out, node->value);
+    }
+    n += out.print('}');
+    return n;
+}
+
+namespace {
+    class CountingPrint : public Print {
+    public:
+        size_t length = 0;
+        size_t write(uint8_t c) override { length++; return 1; }
+        size_t write(const uint8_t* buffer, size_t size) override { length += size; return size; }
+    };
+
+    class StringPrint : public Print {
+    public:
+        char* buffer;
+        size_t size;
+        size_t length = 0;
+
+        StringPrint(char* buffer, size_t size) : buffer(buffer), size(size) { }
+        size_t write(uint8_t c) override {
+            if (length + 1 >= size) {
+                return 0;
+            }
+            buffer[length++] = c;
+            buffer[length] = '\0';
+            return 1;
+        }
+    };
+}
+
+size_t JsonObject::printTo(char* buffer, size_t size) const {
+    if (size > 0) {
+        buffer[0] = '\0';
+    }
+    StringPrint out(buffer, size);
+    printTo(out);
+    return out.length;
+}
+
+size_t JsonObject::measureLength() const {
+    CountingPrint counter;
+    printTo(counter);
+    return counter.length;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+// Host stand-in for the subset of ArduinoJson 5 used by hacomponent.
+// Like the real library, the tree lives entirely in the JsonBuffer (no heap),
+// const char* keys/values are stored by pointer, and char*, String and
+// flash strings are copied into the buffer. Node sizes differ from a 32 bit
+// target, so buffer sizes that only just fit on the device may not fit here.
+
+#include <Arduino.h>
+#include <type_traits>
+
+class JsonObject;
+class JsonArray;
+
+class JsonBuffer {
+public:
+    JsonObject& createObject();
+
+    /// @brief Bytes of the buffer in use
+    size_t size() const { return m_size; }
+    void clear() { m_size = 0; }
+
+    /// @brief nullptr when full (virtual, as in ArduinoJson 5)
+    virtual void* alloc(size_t bytes);
+    const char* strdup(const char* str, size_t length);
+
+protected:
+    JsonBuffer(uint8_t* buffer, size_t capacity)
+        : m_buffer(buffer), m_capacity(capacity), m_size(0)
+    { }
+
+private:
+    uint8_t* m_buffer;
+    size_t m_capacity;
+    size_t m_size;
+};
+
+template<size_t CAPACITY>
+class StaticJsonBuffer : public JsonBuffer {
+public:
+    StaticJsonBuffer() : JsonBuffer(m_data, CAPACITY) { }
+
+private:
+    alignas(8) uint8_t m_data[CAPACITY];
+};
+
+struct JsonVariant {
+    enum class Type : uint8_t { Null, String, Bool, Integer, Unsigned, Float, Object, Array };
+
+    Type type = Type::Null;
+    union {
+        const char* string;
+        bool boolean;
+        long long integer;
+        unsigned long long uinteger;
+        double number;
+        JsonObject* object;
+        JsonArray* array;
+    };
+
+    JsonVariant() : integer(0) { }
+};
+
+class JsonObject {
+public:
+    // Proxy returned by operator[], assigning sets the member
+    class Subscript {
+    public:
+        Subscript(JsonObject& object, const char* key) : m_object(object), m_key(key) { }
+
+        template<typename T>
+        Subscript& operator=(const T& value) { m_object.set(m_key, value); return *this; }
+        Subscript& operator=(const char* value) { m_object.set(m_key, value); return *this; }
+        Subscript& operator=(char* value) { m_object.set(m_key, value); return *this; }
+
+    private:
+        JsonObject& m_object;
+        const char* m_key;
+    };
+
+    explicit JsonObject(JsonBuffer* buffer) : m_buffer(buffer) { }
+
+    /// @brief false if the buffer was too small to create this object
+    bool success() const { return m_buffer != nullptr; }
+    static JsonObject& invalid();
+
+    Subscript operator[](const char* key) { return Subscript(*this, key); }
+
+    bool set(const char* key, const char* value);
+    bool set(const char* key, char* value) { return setCopy(key, value, (value != nullptr) ? strlen(value) : 0, value == nullptr); }
+    bool set(const char* key, const __FlashStringHelper* value) { return set(key, (char*)value); }
+    bool set(const char* key, const String& value) { return setCopy(key, value.c_str(), value.length(), false); }
+    bool set(const char* key, bool value);
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, bool>::type
+    set(const char* key, T value) { return setNumber(key, JsonVariant::Type::Integer, (long long)value); }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value && !std::is_same<T, bool>::value, bool>::type
+    set(const char* key, T value) { return setNumber(key, JsonVariant::Type::Unsigned, (long long)value); }
+
+    template<typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+    set(const char* key, T value);
+
+    JsonObject& createNestedObject(const char* key);
+    JsonArray& createNestedArray(const char* key);
+
+    /// @brief Number of members
+    size_t size() const;
+
+    size_t printTo(Print& out) const;
+    size_t printTo(char* buffer, size_t size) const;
+    size_t measureLength() const;
+
+private:
+    struct Node {
+        const char* key;
+        JsonVariant value;
+        Node* next;
+    };
+
+    JsonBuffer* m_buffer;
+    Node* m_first = nullptr;
+    Node* m_last = nullptr;
+
+    JsonVariant* slot(const char* key);
+    bool setCopy(const char* key, const char* value, size_t length, bool null);
+    bool setNumber(const char* key, JsonVariant::Type type, long long value);
+    static size_t printString(Print& out, const char* str);
+    static size_t printVariant(Print& out, const JsonVariant& value);
+
+    friend class JsonArray;
+};
+
+// Array of objects, the only kind of array hacomponent builds
+class JsonArray {
+public:
+    explicit JsonArray(JsonBuffer* buffer) : m_buffer(buffer) { }
+
+    bool success() const { return m_buffer != nullptr; }
+    static JsonArray& invalid();
+
+    JsonObject& createNestedObject();
+
+    size_t size() const;
+    size_t printTo(Print& out) const;
+
+private:
+    struct Node {
+        JsonObject* object;
+        Node* next;
+    };
+
+    JsonBuffer* m_buffer;
+    Node* m_first = nullptr;
+    Node* m_last = nullptr;
+};
+
+template<typename T>
+typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+JsonObject::set(const char* key, T value) {
+    JsonVariant* v = slot(key);
+    if (v == nullptr) {
+        return false;
+    }
+    v->type = JsonVariant::Type::Float;
+    v->number = value;
+    return true;
+}
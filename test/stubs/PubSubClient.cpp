@@ -0,0 +1,216 @@
+#include <PubSubClient.h>
+
+// As in PubSubClient, for the buffer size checks
+#define MQTT_MAX_HEADER_SIZE 5
+#define INBOUND_BUFFER_SIZE (64 * 1024)
+
+PubSubClient::PubSubClient()
+    : m_arena(new uint8_t[ARENA_SIZE]),
+      m_inbound(new uint8_t[INBOUND_BUFFER_SIZE])
+{
+    for (auto& sub : m_subscriptions) {
+        sub[0] = '\0';
+    }
+}
+
+PubSubClient::~PubSubClient() {
+    delete[] m_arena;
+    delete[] m_inbound;
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass) {
+    m_will_topic[0] = '\0';
+    m_will_message[0] = '\0';
+    m_connected = true;
+    return true;
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass,
+                           const char* will_topic, uint8_t will_qos, bool will_retain, const char* will_message) {
+    snprintf(m_will_topic, sizeof(m_will_topic), "%s", will_topic);
+    snprintf(m_will_message, sizeof(m_will_message), "%s", will_message);
+    m_connected = true;
+    return true;
+}
+
+const uint8_t* PubSubClient::store(const void* data, size_t length) {
+    if (length > ARENA_SIZE - m_arena_used) {
+        m_overflowed = true;
+        return nullptr;
+    }
+    uint8_t* p = &m_arena[m_arena_used];
+    if (length > 0) {
+        memcpy(p, data, length);
+    }
+    m_arena_used += length;
+    return p;
+}
+
+void PubSubClient::record(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+    m_published++;
+    m_published_bytes += strlen(topic) + length;
+    if (!m_recording) {
+        return;
+    }
+    if (m_count == MAX_MESSAGES || payload == nullptr) {
+        m_overflowed = true;
+        return;
+    }
+    const char* t = (const char*)store(topic, strlen(topic) + 1);
+    if (t == nullptr) {
+        return;
+    }
+    m_messages[m_count++] = { t, payload, length, retain };
+}
+
+// The real client builds outbound packets in the same buffer inbound
+// messages are received in, so a publish from the callback overwrites
+// the topic and payload it was given.
+void PubSubClient::clobberInbound(size_t length) {
+    if (length > INBOUND_BUFFER_SIZE) {
+        length = INBOUND_BUFFER_SIZE;
+    }
+    memset(m_inbound, 0x55, length);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain) {
+    if (!m_connected || m_failing) {
+        return false;
+    }
+    if (MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + length > m_buffer_size) {
+        // Too large for the client buffer
+        return false;
+    }
+    clobberInbound(MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + length);
+    record(topic, m_recording ? store(payload, length) : payload, length, retain);
+    return true;
+}
+
+bool PubSubClient::beginPublish(const char* topic, unsigned int length, bool retain) {
+    if (!m_connected || m_failing) {
+        return false;
+    }
+    clobberInbound(MQTT_MAX_HEADER_SIZE + 2 + strlen(topic));
+    snprintf(m_topic, sizeof(m_topic), "%s", topic);
+    m_expected = length;
+    m_written = 0;
+    m_retain = retain;
+    m_payload_start = m_arena_used;
+    m_writing = true;
+    return true;
+}
+
+size_t PubSubClient::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t PubSubClient::write(const uint8_t* buffer, size_t size) {
+    m_write_calls++;
+    if (!m_writing) {
+        return 0;
+    }
+    m_written += size;
+    if (m_recording) {
+        store(buffer, size);
+    }
+    return size;
+}
+
+int PubSubClient::endPublish() {
+    if (!m_writing) {
+        return 0;
+    }
+    m_writing = false;
+    if (m_written != m_expected) {
+        // The broker would read the next packet as part of this one
+        fprintf(stderr, "PubSubClient: %s declared %u bytes, wrote %u\n", m_topic, m_expected, m_written);
+        abort();
+    }
+    bool complete = (m_arena_used - m_payload_start == m_written);
+    record(m_topic, complete ? &m_arena[m_payload_start] : nullptr, m_written, m_retain);
+    return 1;
+}
+
+bool PubSubClient::subscribe(const char* topic) {
+    if (!m_connected) {
+        return false;
+    }
+    if (isSubscribed(topic)) {
+        return true;
+    }
+    for (auto& sub : m_subscriptions) {
+        if (sub[0] == '\0') {
+            snprintf(sub, sizeof(sub), "%s", topic);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PubSubClient::unsubscribe(const char* topic) {
+    for (auto& sub : m_subscriptions) {
+        if (strcmp(sub, topic) == 0) {
+            sub[0] = '\0';
+        }
+    }
+    return m_connected;
+}
+
+bool PubSubClient::isSubscribed(const char* topic) const {
+    for (auto& sub : m_subscriptions) {
+        if (strcmp(sub, topic) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PubSubClient::deliver(const char* topic, const uint8_t* payload, unsigned int length) {
+    size_t topic_len = strlen(topic);
+    if (MQTT_MAX_HEADER_SIZE + 2 + topic_len + length > m_buffer_size ||
+        topic_len + length + 2 > INBOUND_BUFFER_SIZE) {
+        return false;
+    }
+
+    // Same layout as the client buffer: NUL-terminated topic, then the payload.
+    // The byte after the payload is not NUL, to catch code relying on it.
+    char* t = (char*)m_inbound;
+    memcpy(t, topic, topic_len + 1);
+    uint8_t* p = &m_inbound[topic_len + 1];
+    memcpy(p, payload, length);
+    p[length] = '#';
+
+    if (m_callback != nullptr) {
+        m_callback(t, p, length);
+    }
+    return true;
+}
+
+void PubSubClient::clear() {
+    m_count = 0;
+    m_arena_used = 0;
+    m_overflowed = false;
+    m_published = 0;
+    m_published_bytes = 0;
+    m_write_calls = 0;
+    m_loops = 0;
+}
+
+const PubSubClient::Message* PubSubClient::find(const char* topic) const {
+    for (size_t i = m_count; i > 0; i--) {
+        if (m_messages[i - 1].is(topic)) {
+            return &m_messages[i - 1];
+        }
+    }
+    return nullptr;
+}
+
+size_t PubSubClient::countMatching(const char* substring) const {
+    size_t n = 0;
+    for (size_t i = 0; i < m_count; i++) {
+        if (strstr(m_messages[i].topic, substring) != nullptr) {
+            n++;
+        }
+    }
+    return n;
+}
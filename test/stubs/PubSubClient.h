@@ -0,0 +1,126 @@
+#pragma once
+
+// Host stand-in for PubSubClient that records everything published into
+// fixed storage (so recording doesn't show up in the allocation counters),
+// and lets tests deliver inbound messages to the callback.
+
+#include <Arduino.h>
+
+#define MQTT_MAX_PACKET_SIZE 256
+
+class PubSubClient : public Print {
+public:
+    typedef void (*Callback)(char* topic, uint8_t* payload, unsigned int length);
+
+    struct Message {
+        const char* topic;
+        const uint8_t* payload;    // Not NUL-terminated
+        unsigned int length;
+        bool retain;
+
+        bool is(const char* t) const { return strcmp(topic, t) == 0; }
+        bool payloadIs(const char* p) const { return length == strlen(p) && memcmp(payload, p, length) == 0; }
+    };
+
+    static const size_t MAX_MESSAGES = 4096;
+    static const size_t MAX_SUBSCRIPTIONS = 64;
+    static const size_t ARENA_SIZE = 1 << 20;
+
+    PubSubClient();
+    ~PubSubClient();
+
+    PubSubClient& setCallback(Callback callback) { m_callback = callback; return *this; }
+    bool setBufferSize(uint16_t size) { m_buffer_size = size; return true; }
+    uint16_t getBufferSize() { return m_buffer_size; }
+
+    bool connect(const char* id, const char* user, const char* pass);
+    bool connect(const char* id, const char* user, const char* pass,
+                 const char* will_topic, uint8_t will_qos, bool will_retain, const char* will_message);
+    void disconnect() { m_connected = false; }
+    bool connected() { return m_connected; }
+    int state() { return m_connected ? 0 : -1; }
+    bool loop() { m_loops++; return m_connected; }
+
+    bool publish(const char* topic, const char* payload) { return publish(topic, payload, false); }
+    bool publish(const char* topic, const char* payload, bool retain) {
+        return publish(topic, (const uint8_t*)payload, (payload != nullptr) ? strlen(payload) : 0, retain);
+    }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retain);
+
+    bool beginPublish(const char* topic, unsigned int length, bool retain);
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int endPublish();
+
+    bool subscribe(const char* topic);
+    bool subscribe(const char* topic, uint8_t qos) { return subscribe(topic); }
+    bool unsubscribe(const char* topic);
+
+    // Test side
+
+    /// Hand a message to the callback, like an inbound PUBLISH.
+    /// Dropped (as by the real client) if it doesn't fit the buffer.
+    /// @return false if dropped
+    bool deliver(const char* topic, const uint8_t* payload, unsigned int length);
+    bool deliver(const char* topic, const char* payload) { return deliver(topic, (const uint8_t*)payload, strlen(payload)); }
+
+    /// Forget recorded messages and reset the counters
+    void clear();
+
+    /// Only count published messages, without recording them (for benchmarks)
+    void setRecording(bool enable) { m_recording = enable; }
+
+    /// Make publishes fail, as when the connection drops mid-way
+    void setFailing(bool fail) { m_failing = fail; }
+
+    size_t count() const { return m_count; }
+    const Message& operator[](size_t i) const { return m_messages[i]; }
+    const Message* find(const char* topic) const;     // Latest message on topic
+    size_t countMatching(const char* substring) const;
+    bool overflowed() const { return m_overflowed; }
+
+    uint32_t published() const { return m_published; }
+    size_t publishedBytes() const { return m_published_bytes; }
+    uint32_t writeCalls() const { return m_write_calls; }
+    uint32_t loops() const { return m_loops; }
+
+    bool isSubscribed(const char* topic) const;
+    const char* getWillTopic() const { return m_will_topic; }
+    const char* getWillMessage() const { return m_will_message; }
+
+private:
+    Callback m_callback = nullptr;
+    uint16_t m_buffer_size = MQTT_MAX_PACKET_SIZE;
+    bool m_connected = false;
+    bool m_failing = false;
+    bool m_recording = true;
+    bool m_overflowed = false;
+
+    Message m_messages[MAX_MESSAGES];
+    size_t m_count = 0;
+    uint8_t* m_arena;
+    size_t m_arena_used = 0;
+
+    char m_subscriptions[MAX_SUBSCRIPTIONS][128];
+    char m_will_topic[128] = "";
+    char m_will_message[128] = "";
+
+    // Message being streamed in
+    bool m_writing = false;
+    char m_topic[128];
+    unsigned int m_expected = 0;
+    unsigned int m_written = 0;
+    bool m_retain = false;
+    size_t m_payload_start = 0;
+
+    uint8_t* m_inbound;
+
+    uint32_t m_published = 0;
+    size_t m_published_bytes = 0;
+    uint32_t m_write_calls = 0;
+    uint32_t m_loops = 0;
+
+    const uint8_t* store(const void* data, size_t length);
+    void clobberInbound(size_t length);
+    void record(const char* topic, const uint8_t* payload, unsigned int length, bool retain);
+};
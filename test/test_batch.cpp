@@ -0,0 +1,123 @@
+// Batch updates: the same reported values as adding each sample with
+// update(float), skipping non-finite samples, for every batch length. EMA
+// and Percentile take the sequential path, the others the block path.
+
+#include "harness.h"
+#include <vector>
+
+#if !defined(HA_SENSOR_EMA) || !defined(HA_SENSOR_PERCENTILE)
+#error "Build with HA_SENSOR_EMA and HA_SENSOR_PERCENTILE"
+#endif
+
+PubSubClient client;
+ComponentContext context(client);
+
+HAComponent<Component::Sensor> scalar(context, "scalar", "Scalar", 1000);
+HAComponent<Component::Sensor> batch(context, "batch", "Batch", 1000);
+HAComponent<Component::Sensor> adc(context, "adc", "ADC", 1000);
+
+// Close the current report interval: the windows are reported by service()
+static void nextInterval() {
+    advanceMillis(1000);
+    client.clear();
+    HAComponentManager::service();
+}
+
+// The payload published by a sensor in the last interval (empty if none)
+static std::string reported(const char* id) {
+    std::string topic = std::string("dev/sensor/") + id + "/state";
+    const PubSubClient::Message* state = client.find(topic.c_str());
+    return (state != nullptr) ? harness::payload(*state) : std::string();
+}
+
+// Add samples one at a time to scalar and as one batch to batch, and compare
+static void compare(SensorAggregation mode, const std::vector<float>& samples) {
+    scalar.setAggregation(mode);
+    batch.setAggregation(mode);
+    nextInterval();
+    for (float x : samples) {
+        scalar.update(x);
+    }
+    batch.update(samples.data(), samples.size());
+    nextInterval();
+    CHECK_STR(reported("batch"), reported("scalar"));
+}
+
+static void testAggregations() {
+    scalar.setPrecision(4);
+    batch.setPrecision(4);
+
+    // Every length up to a few lanes, so the tail loop is covered
+    for (size_t n = 1; n <= 40; n++) {
+        std::vector<float> samples;
+        for (size_t i = 0; i < n; i++) {
+            samples.push_back((i % 3 == 1) ? NAN : (float)((i * 37) % 11) - 5.f);
+        }
+        for (SensorAggregation mode : { SensorAggregation::Mean, SensorAggregation::Min, SensorAggregation::Max,
+                                        SensorAggregation::Last, SensorAggregation::RMS,
+                                        SensorAggregation::EMA, SensorAggregation::Percentile }) {
+            compare(mode, samples);
+        }
+    }
+}
+
+static void testRms() {
+    // 50 Hz sine, amplitude 10, sampled at 5 kHz (RMS about 10 / sqrt(2)),
+    // with two samples dropped
+    std::vector<float> samples;
+    for (int i = 0; i < 5000; i++) {
+        samples.push_back(10.f * sinf(2.f * (float)M_PI * 50.f * i / 5000.f));
+    }
+    samples[100] = INFINITY;
+    samples[4999] = NAN;
+    batch.setAggregation(SensorAggregation::RMS);
+    nextInterval();
+    batch.update(samples.data(), samples.size());
+    nextInterval();
+    double sum_sq = 0.0;
+    for (int i = 0; i < 5000; i++) {
+        sum_sq += (i == 100 || i == 4999) ? 0.0 : (double)samples[i] * samples[i];
+    }
+    CHECK(fabs(atof(reported("batch").c_str()) - sqrt(sum_sq / 4998)) < 1e-3);
+
+    // Nothing finite, nothing reported
+    const float nan[] = { NAN, INFINITY, -INFINITY };
+    nextInterval();
+    batch.update(nan, 3);
+    batch.update(nan, 0);
+    nextInterval();
+    CHECK_STR(reported("batch"), "");
+}
+
+static void testInt16() {
+    std::vector<int16_t> raw;
+    for (int i = -100; i <= 100; i++) {
+        raw.push_back((int16_t)(i * 300));
+    }
+    adc.setPrecision(4);
+    for (SensorAggregation mode : { SensorAggregation::Mean, SensorAggregation::Min, SensorAggregation::Max,
+                                    SensorAggregation::Last }) {
+        adc.setAggregation(mode);
+        nextInterval();
+        adc.update(raw.data(), raw.size(), 0.001f, 2.f);
+        nextInterval();
+        double expected = (mode == SensorAggregation::Min) ? -28.0 : (mode == SensorAggregation::Mean) ? 2.0 : 32.0;
+        CHECK(fabs(atof(reported("adc").c_str()) - expected) < 1e-3);
+    }
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    HAComponentManager::initializeAll();
+    CHECK(client.connect("dev", nullptr, nullptr));
+    setMillis(100000);
+    HAComponentManager::service();
+
+    testAggregations();
+    testRms();
+    testInt16();
+    return harness::finish();
+}
@@ -0,0 +1,177 @@
+// Bridge mode: many devices (ComponentContexts) with the same component ids
+// on one client, each with its own availability topic and discovery, going
+// offline together with the connection's will.
+
+#include "harness.h"
+#include <memory>
+#include <vector>
+
+#define DEVICES (20)
+
+PubSubClient client;
+
+struct Device {
+    std::string name;
+    std::string mac;
+    ComponentContext context;
+    HAAvailabilityComponent availability;
+    HAComponent<Component::Sensor> temperature;
+    HAComponent<Component::Switch> relay;
+    HAComponent<Component::Switch> valve;
+    int relay_calls = 0;
+    int valve_calls = 0;
+
+    Device(int i) :
+        name("dev" + std::to_string(i)),
+        mac("mac" + std::to_string(i)),
+        context(client),
+        availability(context),
+        temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature),
+        relay(context, "relay", "Relay", [this](bool) { relay_calls++; }),
+        valve(context, "valve", "Valve", [this](bool) { valve_calls++; })
+    {
+        context.mac_address = mac.c_str();
+        context.device_name = name.c_str();
+        context.friendly_name = name.c_str();
+    }
+};
+
+static std::vector<std::unique_ptr<Device>> devices;
+
+static void testConnect() {
+    Device& first = *devices[0];
+    CHECK(HAComponentManager::connectClientWithAvailability(first.context, "gateway", nullptr, nullptr));
+    CHECK_STR(client.getWillTopic(), "dev0/status");
+
+    // Every device on the client is reported available
+    for (auto& device : devices) {
+        const PubSubClient::Message* status = client.find((device->name + "/status").c_str());
+        CHECK(status != nullptr && status->payloadIs("online") && status->retain);
+    }
+}
+
+static void testDiscovery() {
+    client.clear();
+    HAComponentManager::publishConfigAll();
+    CHECK_EQ(client.countMatching("/config"), (size_t)DEVICES * 4);
+
+    // Each config carries its own device block and topics
+    const PubSubClient::Message* config = client.find("homeassistant/sensor/dev7/temp/config");
+    CHECK(config != nullptr);
+    if (config != nullptr) {
+        std::string json = harness::payload(*config);
+        CHECK(json.find("\"identifiers\":\"mac7\"") != std::string::npos);
+        CHECK(json.find("\"stat_t\":\"dev7/sensor/temp/state\"") != std::string::npos);
+    }
+    config = client.find("homeassistant/binary_sensor/dev7/status/config");
+    CHECK(config != nullptr && harness::payload(*config).find("\"stat_t\":\"dev7/status\"") != std::string::npos);
+
+    // One device at a time
+    client.clear();
+    HAComponentManager::publishConfigAll(devices[3]->context);
+    CHECK_EQ(client.countMatching("/config"), (size_t)4);
+    CHECK_EQ(client.countMatching("/dev3/"), (size_t)4);
+}
+
+static void testDispatch() {
+    client.clear();
+    CHECK(client.deliver("dev13/switch/relay/ctrl", "ON"));
+    for (int i = 0; i < DEVICES; i++) {
+        CHECK_EQ(devices[i]->relay_calls, (i == 13) ? 1 : 0);
+        CHECK_EQ(devices[i]->valve_calls, 0);
+    }
+    const PubSubClient::Message* state = client.find("dev13/switch/relay/state");
+    CHECK(state != nullptr && state->payloadIs("ON"));
+    CHECK_EQ(client.count(), (size_t)1);
+
+    // Unknown devices and prefixes of known ones are ignored
+    client.deliver("dev99/switch/relay/ctrl", "ON");
+    client.deliver("dev1/switch/relay/ctrl/x", "ON");
+    client.deliver("dev/switch/relay/ctrl", "ON");
+    CHECK_EQ(devices[1]->relay_calls, 0);
+    CHECK_EQ(devices[13]->relay_calls, 1);
+}
+
+// Availability as HA sees it from the retained messages: every topic in the
+// config's avty list (or just the device's own, without one) must be online
+static bool isAvailable(const Device& device) {
+    std::string topic = "homeassistant/sensor/" + device.name + "/temp/config";
+    const PubSubClient::Message* config = client.find(topic.c_str());
+    CHECK(config != nullptr);
+    if (config == nullptr) {
+        return false;
+    }
+    std::string json = harness::payload(*config);
+
+    std::vector<std::string> topics;
+    size_t avty = json.find("\"avty\":[");
+    if (avty == std::string::npos) {
+        topics.push_back(device.name + "/status");
+    } else {
+        size_t end = json.find(']', avty);
+        for (size_t pos = json.find("\"t\":\"", avty); pos < end; pos = json.find("\"t\":\"", pos)) {
+            pos += 5;
+            topics.push_back(json.substr(pos, json.find('"', pos) - pos));
+        }
+        CHECK(json.find("\"avty_mode\":\"all\"") != std::string::npos);
+    }
+
+    for (auto& t : topics) {
+        const PubSubClient::Message* status = client.find(t.c_str());
+        if (status == nullptr || !status->retain || !status->payloadIs("online")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testAvailability() {
+    client.clear();
+    CHECK(HAComponentManager::connectClientWithAvailability(devices[0]->context, "gateway", nullptr, nullptr));
+    HAComponentManager::publishConfigAll();
+
+    // Bridged devices list their own topic and the gateway's will
+    const PubSubClient::Message* config = client.find("homeassistant/switch/dev7/relay/config");
+    CHECK(config != nullptr && harness::payload(*config).find(
+        "\"avty\":[{\"t\":\"dev7/status\"},{\"t\":\"dev0/status\"}]") != std::string::npos);
+    config = client.find("homeassistant/switch/dev0/relay/config");
+    CHECK(config != nullptr && harness::payload(*config).find("\"avty\"") == std::string::npos);
+
+    for (auto& device : devices) {
+        CHECK(isAvailable(*device));
+    }
+
+    // The connection drops and the broker publishes the will
+    std::string will_topic = client.getWillTopic();
+    std::string will_message = client.getWillMessage();
+    client.publish(will_topic.c_str(), will_message.c_str(), true);
+    client.disconnect();
+
+    for (auto& device : devices) {
+        CHECK(!isAvailable(*device));
+    }
+}
+
+static void testSensors() {
+    client.clear();
+    setMillis(10000);
+    for (auto& device : devices) {
+        device->temperature.update(20.f);
+    }
+    CHECK_EQ(client.countMatching("/sensor/temp/state"), (size_t)DEVICES);
+}
+
+int main() {
+    for (int i = 0; i < DEVICES; i++) {
+        devices.emplace_back(new Device(i));
+    }
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+
+    testConnect();
+    testDiscovery();
+    testDispatch();
+    testSensors();
+    testAvailability();
+    return harness::finish();
+}
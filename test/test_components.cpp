@@ -0,0 +1,173 @@
+// End to end: a sketch-like device with one of each component,
+// publishing discovery configs, states and handling switch commands.
+
+#include "harness.h"
+
+PubSubClient client;
+ComponentContext context(client);
+
+HAAvailabilityComponent availability(context);
+HAComponent<Component::Sensor> temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+HAComponent<Component::Sensor> energy(context, "energy", "Energy", 1000, 0.f, SensorClass::Energy);
+HAComponent<Component::BinarySensor> door(context, "door", "Door", BinarySensorClass::door);
+
+static bool fan_state = false;
+static int fan_calls = 0;
+HAComponent<Component::Switch> fan(context, "fan", "Fan", [](bool state) { fan_state = state; fan_calls++; }, "mdi:fan");
+
+static void testConnect() {
+    CHECK(HAComponentManager::connectClientWithAvailability(client, "dev", "user", "pass"));
+    CHECK_STR(client.getWillTopic(), "dev/status");
+    CHECK_STR(client.getWillMessage(), "offline");
+
+    const PubSubClient::Message* status = client.find("dev/status");
+    CHECK(status != nullptr && status->payloadIs("online") && status->retain);
+}
+
+static void testConfigs() {
+    client.clear();
+    HAComponentManager::publishConfigAll();
+
+    CHECK_EQ(client.countMatching("/config"), (size_t)5);
+    const PubSubClient::Message* config = client.find("homeassistant/sensor/dev/temp/config");
+    CHECK(config != nullptr && config->retain);
+    if (config != nullptr) {
+        std::string json = harness::payload(*config);
+        CHECK(json.find("\"name\":\"Temperature\"") != std::string::npos);
+        CHECK(json.find("\"stat_t\":\"dev/sensor/temp/state\"") != std::string::npos);
+        CHECK(json.find("\"dev_cla\":\"temperature\"") != std::string::npos);
+        CHECK(json.find("\"unique_id\":\"dev_temp\"") != std::string::npos);
+        CHECK(json.find("\"identifiers\":\"AA:BB:CC:DD:EE:FF\"") != std::string::npos);
+    }
+
+    config = client.find("homeassistant/switch/dev/fan/config");
+    CHECK(config != nullptr && harness::payload(*config).find("\"cmd_t\":\"dev/switch/fan/ctrl\"") != std::string::npos);
+
+    // Switches subscribe and report their state once their config is out
+    CHECK(client.isSubscribed("dev/switch/fan/ctrl"));
+    const PubSubClient::Message* state = client.find("dev/switch/fan/state");
+    CHECK(state != nullptr && state->payloadIs("OFF"));
+
+    // Streamed in HA_PUBLISH_CHUNK_SIZE chunks, not a byte or token at a time
+    client.clear();
+    CHECK(temperature.publishConfig());
+    CHECK_EQ(client.count(), (size_t)1);
+    if (client.count() == 1) {
+        CHECK(client.writeCalls() <= (client[0].length + HA_PUBLISH_CHUNK_SIZE - 1) / HA_PUBLISH_CHUNK_SIZE);
+    }
+}
+
+static void testSensor() {
+    client.clear();
+    // Long past the first deadline, reported straight away
+    setMillis(10000);
+    temperature.update(20.f);
+    const PubSubClient::Message* state = client.find("dev/sensor/temp/state");
+    CHECK(state != nullptr && state->payloadIs("20.00"));
+
+    client.clear();
+    advanceMillis(500);
+    temperature.update(22.f);
+    CHECK(client.find("dev/sensor/temp/state") == nullptr);
+
+    // Mean of the window, once the next deadline has passed
+    advanceMillis(600);
+    temperature.update(24.f);
+    state = client.find("dev/sensor/temp/state");
+    CHECK(state != nullptr && state->payloadIs("23.00"));
+
+    // Non-finite samples are ignored
+    client.clear();
+    temperature.update(NAN);
+    advanceMillis(1000);
+    temperature.update(INFINITY);
+    CHECK_EQ(client.count(), (size_t)0);
+}
+
+// Publish a single sample and return the payload as a number
+static double reportEnergy(float value) {
+    client.clear();
+    advanceMillis(1000);
+    energy.update(value);
+    const PubSubClient::Message* state = client.find("dev/sensor/energy/state");
+    CHECK(state != nullptr);
+    if (state == nullptr) {
+        return NAN;
+    }
+    std::string payload = harness::payload(*state);
+    char* end;
+    double number = strtod(payload.c_str(), &end);
+    CHECK(*end == '\0' && payload.length() < 24);
+    return number;
+}
+
+static void testFormatting() {
+    CHECK_EQ(reportEnergy(1.004f), 1.0);
+    CHECK_EQ(reportEnergy(-0.004f), 0.0);
+    CHECK_EQ(reportEnergy(-12.345f), -12.35);
+
+    // Too large to format with integers, still the right value
+    CHECK(fabs(reportEnergy(3.0e25f) / 3.0e25 - 1.0) < 1e-6);
+    CHECK(fabs(reportEnergy(-3.4e38f) / -3.4e38 - 1.0) < 1e-6);
+
+    energy.setPrecision(6);
+    CHECK(fabs(reportEnergy(4294.5f) - 4294.5) < 1e-3);
+    CHECK(fabs(reportEnergy(-1.0e10f) / -1.0e10 - 1.0) < 1e-6);
+    energy.setPrecision(2);
+}
+
+static void testSwitch() {
+    client.clear();
+    CHECK(client.deliver("dev/switch/fan/ctrl", "ON"));
+    CHECK(fan_state);
+    CHECK_EQ(fan_calls, 1);
+    const PubSubClient::Message* state = client.find("dev/switch/fan/state");
+    CHECK(state != nullptr && state->payloadIs("ON"));
+
+    // Case-insensitive, and other topics or payloads are ignored
+    client.deliver("dev/switch/fan/ctrl", "off");
+    CHECK(!fan_state);
+    client.deliver("dev/switch/fan/ctrl", "toggle");
+    client.deliver("dev/switch/other/ctrl", "ON");
+    client.deliver("other/switch/fan/ctrl", "ON");
+    CHECK_EQ(fan_calls, 2);
+}
+
+static void testBinarySensor() {
+    client.clear();
+    door.reportState(true);
+    const PubSubClient::Message* state = client.find("dev/binary_sensor/door/state");
+    CHECK(state != nullptr && state->payloadIs("ON"));
+}
+
+static void testUnpublish() {
+    client.clear();
+    HAComponentManager::publishConfigAll(false);
+
+    // Config and state are cleared (empty retained messages)
+    const PubSubClient::Message* config = client.find("homeassistant/sensor/dev/temp/config");
+    CHECK(config != nullptr && config->length == 0 && config->retain);
+    const PubSubClient::Message* state = client.find("dev/sensor/temp/state");
+    CHECK(state != nullptr && state->length == 0);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+
+    testConnect();
+    testConfigs();
+    testSensor();
+    testFormatting();
+    testSwitch();
+    testBinarySensor();
+    testUnpublish();
+    return harness::finish();
+}
@@ -0,0 +1,130 @@
+// HA_SENSOR_CONCURRENT: samples added from several threads while the
+// consumer takes windows are neither lost, counted twice nor torn.
+
+#include "harness.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifndef HA_SENSOR_CONCURRENT
+#error "Build with HA_SENSOR_CONCURRENT"
+#endif
+
+#define THREADS (4)
+#define SAMPLES_PER_THREAD (200000)
+
+PubSubClient client;
+ComponentContext context(client);
+HAComponent<Component::Sensor> sensor(context, "load", "Load", 1000);
+
+// Every sample is 1, so each window's mean is exactly 1 unless a sample's sum
+// and count ended up in different windows
+static void testWindow() {
+    HAConcurrentWindow window;
+    std::atomic<bool> done(false);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < THREADS; t++) {
+        writers.emplace_back([&window]() {
+            for (int i = 0; i < SAMPLES_PER_THREAD; i++) {
+                window.add(1.f);
+            }
+        });
+    }
+    std::thread finish([&]() {
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        done = true;
+    });
+
+    uint64_t total = 0;
+    int takes = 0, torn = 0;
+    for (;;) {
+        bool last = done;
+        float mean;
+        uint32_t count;
+        if (window.take(SensorAggregation::Mean, mean, &count)) {
+            total += count;
+            takes++;
+            torn += (mean != 1.f);
+        }
+        if (last) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    finish.join();
+
+    CHECK_EQ(total, (uint64_t)THREADS * SAMPLES_PER_THREAD);
+    CHECK_EQ(torn, 0);
+    CHECK(takes > 1);
+}
+
+// Min and Max across threads adding distinct values
+static void testMinMax() {
+    HAConcurrentWindow window;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < THREADS; t++) {
+        writers.emplace_back([&window, t]() {
+            for (int i = 0; i < 1000; i++) {
+                window.add((float)(t * 1000 + i));
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    float value;
+    uint32_t count;
+    CHECK(window.take(SensorAggregation::Max, value, &count));
+    CHECK_EQ(value, (float)(THREADS * 1000 - 1));
+    CHECK_EQ(count, (uint32_t)THREADS * 1000);
+    CHECK(!window.take(SensorAggregation::Min, value));
+}
+
+// Through the sensor: updates from threads, published by service()
+static void testSensor() {
+    HAComponentManager::initializeAll();
+    CHECK(client.connect("dev", nullptr, nullptr));
+    HAComponentManager::service();
+
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < THREADS; t++) {
+        writers.emplace_back([&stop]() {
+            while (!stop) {
+                sensor.update(2.f);
+            }
+        });
+    }
+
+    client.clear();
+    for (int i = 0; i < 50; i++) {
+        advanceMillis(1000);
+        HAComponentManager::service();
+        std::this_thread::yield();
+    }
+    stop = true;
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    size_t states = client.countMatching("dev/sensor/load/state");
+    CHECK(states > 0);
+    for (size_t i = 0; i < client.count(); i++) {
+        if (client[i].is("dev/sensor/load/state")) {
+            CHECK_STR(harness::payload(client[i]), "2.00");
+        }
+    }
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    testWindow();
+    testMinMax();
+    testSensor();
+    return harness::finish();
+}
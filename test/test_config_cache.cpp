@@ -0,0 +1,99 @@
+// HA_CONFIG_CACHE_SIZE: configs streamed from the cache are byte for byte
+// the ones serialized without it, and publishing them doesn't allocate.
+
+#include "harness.h"
+#include <vector>
+
+#if HA_CONFIG_CACHE_SIZE <= 0
+#error "Build with HA_CONFIG_CACHE_SIZE"
+#endif
+
+// A component whose cached config can be dropped, to publish it serialized
+template<typename Base>
+class Uncachable : public Base {
+public:
+    using Base::Base;
+    void dropCache() { this->m_config_cache = nullptr; }
+};
+
+PubSubClient client;
+ComponentContext context(client);
+
+Uncachable<HAAvailabilityComponent> availability(context);
+Uncachable<HAComponent<Component::Sensor>> temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+Uncachable<HAComponent<Component::Sensor>> humidity(context, "humid", "Humidity", 1000, 0.f, SensorClass::Humidity);
+Uncachable<HAComponent<Component::BinarySensor>> door(context, "door", "Door", BinarySensorClass::door);
+Uncachable<HAComponent<Component::Switch>> light(context, "light", "Light", [](bool) { });
+Uncachable<HAComponent<Component::Counter>> energy(context, "energy", "Energy", 10000, 1000.f, "kWh", "energy");
+Uncachable<HACounterRate> power(context, "energy", "power", "Power", "W", 1000.f, "power");
+Uncachable<HAStatsComponent> stats(context, 1000);
+HASensorGroup env(context, "env");
+
+typedef std::vector<std::pair<std::string, std::string>> Configs;
+
+static Configs publishConfigs() {
+    client.clear();
+    HAComponentManager::publishConfigAll();
+    Configs configs;
+    for (size_t i = 0; i < client.count(); i++) {
+        if (strstr(client[i].topic, "/config") != nullptr) {
+            configs.emplace_back(client[i].topic, harness::payload(client[i]));
+        }
+    }
+    return configs;
+}
+
+static void testIdentical() {
+    Configs cached = publishConfigs();
+    CHECK_EQ(cached.size(), (size_t)8);
+
+    size_t length = 0;
+    for (const auto& config : cached) {
+        length += config.second.size();
+    }
+    CHECK_EQ(HAComponentManager::getConfigCacheUsed(), length);
+
+    availability.dropCache();
+    temperature.dropCache();
+    humidity.dropCache();
+    door.dropCache();
+    light.dropCache();
+    energy.dropCache();
+    power.dropCache();
+    stats.dropCache();
+    Configs serialized = publishConfigs();
+    CHECK_EQ(serialized.size(), cached.size());
+    for (size_t i = 0; i < cached.size() && i < serialized.size(); i++) {
+        CHECK_STR(cached[i].first, serialized[i].first);
+        CHECK_STR(cached[i].second, serialized[i].second);
+    }
+}
+
+static void testNoAllocations() {
+    // Rebuilt, as the previous test dropped it
+    HAComponentManager::initializeAll();
+    client.setRecording(false);
+    client.clear();
+    size_t allocations = harness::allocations();
+    HAComponentManager::publishConfigAll();
+    CHECK_EQ(harness::allocations() - allocations, (size_t)0);
+    CHECK_EQ(client.published(), 8u);
+    client.setRecording(true);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+    humidity.setGroup(env);
+
+    HAComponentManager::initializeAll();
+    CHECK(client.connect("dev", nullptr, nullptr));
+
+    testIdentical();
+    testNoAllocations();
+    return harness::finish();
+}
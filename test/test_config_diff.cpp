@@ -0,0 +1,90 @@
+// Retained config diffing (HAComponentManager::setConfigDiff): configs the
+// broker already holds are skipped, changed ones republished and orphans
+// cleared, from the retained configs delivered during the sync window.
+
+#include "harness.h"
+
+PubSubClient client;
+ComponentContext context(client);
+
+HAComponent<Component::Sensor> temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+HAComponent<Component::BinarySensor> door(context, "door", "Door", BinarySensorClass::door);
+
+static const char* const temp_topic = HA_CONFIG_TOPIC("sensor", "dev", "temp");
+static const char* const door_topic = HA_CONFIG_TOPIC("binary_sensor", "dev", "door");
+static const char* const orphan_topic = HA_CONFIG_TOPIC("sensor", "dev", "removed");
+static const char* const sync_topic = HA_CONFIG_TOPIC("+", "dev", "+");
+
+static void sync() {
+    advanceMillis(HA_CONFIG_SYNC_MS);
+    size_t calls = 0;
+    while (!HAComponentManager::service() && calls++ < 100) {
+    }
+    CHECK(HAComponentManager::isConfigComplete());
+}
+
+static void testDiff() {
+    // What the broker retained from a previous run
+    client.clear();
+    HAComponentManager::publishConfigAll();
+    const PubSubClient::Message* config = client.find(temp_topic);
+    CHECK(config != nullptr);
+    std::string temp_config = (config != nullptr) ? harness::payload(*config) : std::string();
+
+    HAConfigStats before = HAComponentManager::getConfigStats();
+    client.clear();
+    HAComponentManager::requestConfigAll();
+    CHECK(client.isSubscribed(sync_topic));
+
+    // Unchanged, changed, orphaned and already unpublished configs
+    CHECK(client.deliver(temp_topic, temp_config.c_str()));
+    CHECK(client.deliver(door_topic, "{\"name\":\"Old door\"}"));
+    CHECK(client.deliver(orphan_topic, "{\"name\":\"Removed\"}"));
+    CHECK(client.deliver(HA_CONFIG_TOPIC("sensor", "dev", "gone"), ""));
+
+    // Nothing published until the sync window closes, except the orphan cleared
+    CHECK(!HAComponentManager::service());
+    const PubSubClient::Message* orphan = client.find(orphan_topic);
+    CHECK(orphan != nullptr && orphan->length == 0 && orphan->retain);
+    CHECK(client.find(door_topic) == nullptr);
+    CHECK(client.find(HA_CONFIG_TOPIC("sensor", "dev", "gone")) == nullptr);
+
+    sync();
+    CHECK(!client.isSubscribed(sync_topic));
+    CHECK(client.find(temp_topic) == nullptr);
+    config = client.find(door_topic);
+    CHECK(config != nullptr && config->retain && config->length > 0);
+
+    const HAConfigStats& after = HAComponentManager::getConfigStats();
+    CHECK_EQ(after.skipped - before.skipped, 1u);
+    CHECK_EQ(after.removed - before.removed, 1u);
+    CHECK_EQ(after.published - before.published, 1u);
+}
+
+// Configs missing on the broker (eg. after a broker reset) are all published
+static void testEmptyBroker() {
+    HAConfigStats before = HAComponentManager::getConfigStats();
+    client.clear();
+    HAComponentManager::requestConfigAll();
+    sync();
+    CHECK(client.find(temp_topic) != nullptr);
+    CHECK(client.find(door_topic) != nullptr);
+    CHECK_EQ(HAComponentManager::getConfigStats().skipped - before.skipped, 0u);
+    CHECK_EQ(HAComponentManager::getConfigStats().published - before.published, 2u);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    HAComponentManager::setConfigDiff(true);
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+    client.setBufferSize(1024);
+    CHECK(client.connect("dev", nullptr, nullptr));
+
+    testDiff();
+    testEmptyBroker();
+    return harness::finish();
+}
@@ -0,0 +1,88 @@
+// Pulse counters: the total is exact past the float range, the 32 bit pulse
+// count may wrap between reports, and the rate is in units per hour.
+
+#include "harness.h"
+
+PubSubClient client;
+ComponentContext context(client);
+
+// 1000 pulses per kWh, and a fractional 2.5 pulses per litre
+HAComponent<Component::Counter> energy(context, "energy", "Energy", 1000, 1000.f, "kWh", "energy");
+HAComponent<Component::Counter> water(context, "water", "Water", 1000, 2.5f, "L", "water");
+
+// Next report, returning the counter's state payload
+static std::string report(const char* id) {
+    client.clear();
+    advanceMillis(1000);
+    HAComponentManager::service();
+    std::string topic = std::string("dev/sensor/") + id + "/state";
+    const PubSubClient::Message* state = client.find(topic.c_str());
+    return (state != nullptr) ? harness::payload(*state) : std::string();
+}
+
+static std::string total(const std::string& state) {
+    size_t start = state.find("\"total\":") + 8;
+    return state.substr(start, state.find(',') - start);
+}
+
+static void testConfig() {
+    HAComponentManager::publishConfigAll();
+    const PubSubClient::Message* config = client.find("homeassistant/sensor/dev/energy/config");
+    CHECK(config != nullptr);
+    if (config != nullptr) {
+        std::string json = harness::payload(*config);
+        CHECK(json.find("\"stat_cla\":\"total_increasing\"") != std::string::npos);
+        CHECK(json.find("\"val_tpl\":\"{{ value_json.total }}\"") != std::string::npos);
+        CHECK(json.find("\"unit_of_meas\":\"kWh\"") != std::string::npos);
+    }
+}
+
+static void testTotal() {
+    CHECK_STR(report("energy"), "{\"total\":0.000,\"rate\":0.000000}");
+
+    // 1.5 kWh in one second is 5400 kWh per hour (too large for 6 fixed decimals)
+    energy.increment(1500);
+    CHECK_STR(report("energy"), "{\"total\":1.500,\"rate\":5400}");
+
+    // Past 2^32 pulses, wrapping the interrupt counter, one pulse still shows
+    for (int i = 0; i < 3; i++) {
+        energy.increment(0x80000000u);
+        report("energy");
+        energy.increment(0x80000000u);
+        report("energy");
+    }
+    energy.increment(1);
+    CHECK_STR(report("energy"), "{\"total\":12884903.389,\"rate\":3.600000}");
+    CHECK_STR(report("energy"), "{\"total\":12884903.389,\"rate\":0.000000}");
+
+    // Rounded to the nearest, half a step up
+    energy.setPrecision(2);
+    energy.increment(6);
+    CHECK_STR(total(report("energy")), "12884903.40");
+    energy.setPrecision(0);
+    energy.increment(105);
+    CHECK_STR(total(report("energy")), "12884904");
+    energy.setPrecision(3);
+}
+
+static void testFractional() {
+    water.increment(10);
+    CHECK_STR(report("water"), "{\"total\":4.000,\"rate\":14400}");
+    water.increment(1);
+    CHECK_STR(report("water"), "{\"total\":4.400,\"rate\":1440.000000}");
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    HAComponentManager::initializeAll();
+    CHECK(client.connect("dev", nullptr, nullptr));
+    HAComponentManager::service();
+
+    testConfig();
+    testTotal();
+    testFractional();
+    return harness::finish();
+}
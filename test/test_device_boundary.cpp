@@ -0,0 +1,87 @@
+// Device discovery near HA_DEVICE_JSON_BUFFER_SIZE: devices of 8-20 sensors,
+// the last with an id of 1-44 characters (the longest that fits its config
+// topic) in a group, so its value template copy is up to 66 bytes, and the
+// buffer runs out at every point of the last component's config. Each device is either published
+// complete as one device config or falls back to per-component configs,
+// never truncated.
+
+#include "harness.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+PubSubClient client;
+
+struct Device {
+    std::string name;
+    ComponentContext context;
+    HASensorGroup group;
+    size_t sensors;
+    std::string last_id;
+
+    Device(size_t sensors, size_t last_length)
+        : name("b" + std::to_string(sensors) + "_" + std::to_string(last_length)), context(client), group(context, "g"),
+          sensors(sensors), last_id(last_length, 'x') { }
+};
+
+static std::deque<std::string> ids;
+static std::vector<std::unique_ptr<Device>> devices;
+static std::vector<std::unique_ptr<HAComponent<Component::Sensor>>> sensors;
+
+static size_t countOf(const std::string& json, const std::string& what) {
+    size_t count = 0;
+    for (size_t at = json.find(what); at != std::string::npos; at = json.find(what, at + 1)) {
+        count++;
+    }
+    return count;
+}
+
+static void testBoundary() {
+    size_t complete = 0, fallback = 0;
+    for (auto& device : devices) {
+        client.clear();
+        HAComponentManager::publishConfigAll(device->context);
+        std::string topic = "homeassistant/device/" + device->name + "/config";
+        const PubSubClient::Message* config = client.find(topic.c_str());
+        if (config == nullptr) {
+            CHECK_EQ(client.countMatching("/config"), device->sensors);
+            fallback++;
+            continue;
+        }
+        std::string json = harness::payload(*config);
+        std::string uid = device->name + "_" + device->last_id;
+        CHECK_EQ(countOf(json, "\"p\":\"sensor\""), device->sensors);
+        CHECK_EQ(countOf(json, "\"object_id\":"), device->sensors);
+        CHECK(json.find("\"val_tpl\":\"{{ value_json['" + device->last_id + "'] }}\"") != std::string::npos);
+        CHECK(json.find("\"unique_id\":\"" + uid + "\",\"object_id\":\"" + uid + "\"") != std::string::npos);
+        complete++;
+    }
+    // The range covers both sides
+    CHECK(complete > 0 && fallback > 0);
+}
+
+int main() {
+    for (size_t count = 8; count <= 20; count++) {
+        for (size_t length = 1; length <= 44; length++) {
+            devices.emplace_back(new Device(count, length));
+            Device& device = *devices.back();
+            device.context.mac_address = device.name.c_str();
+            device.context.device_name = device.name.c_str();
+            device.context.friendly_name = device.name.c_str();
+            for (size_t i = 0; i < count; i++) {
+                ids.push_back((i + 1 < count) ? "s" + std::to_string(i) : device.last_id);
+                const char* id = ids.back().c_str();
+                sensors.emplace_back(new HAComponent<Component::Sensor>(device.context, id, id, 1000, 0.f, SensorClass::Temperature));
+            }
+            sensors.back()->setGroup(device.group);
+        }
+    }
+
+    HAComponentManager::setDeviceDiscovery(true);
+    HAComponentManager::initializeAll();
+    client.setBufferSize(8192);
+    CHECK(client.connect("gateway", nullptr, nullptr));
+
+    testBoundary();
+    return harness::finish();
+}
@@ -0,0 +1,96 @@
+// Device discovery with two devices on one client: a small one published as a
+// single device config, and one too large for HA_DEVICE_JSON_BUFFER_SIZE that
+// falls back to per-component configs on its own.
+
+#include "harness.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+#define LARGE_SENSORS (60)
+
+PubSubClient client;
+ComponentContext small_device(client);
+ComponentContext large_device(client);
+
+HAComponent<Component::Sensor> temperature(small_device, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+HAComponent<Component::Switch> fan(small_device, "fan", "Fan", [](bool) { });
+
+static std::deque<std::string> ids;
+static std::vector<std::unique_ptr<HAComponent<Component::Sensor>>> sensors;
+
+static void checkConfigs() {
+    const PubSubClient::Message* config = client.find("homeassistant/device/small/config");
+    CHECK(config != nullptr && config->retain);
+    if (config != nullptr) {
+        std::string json = harness::payload(*config);
+        CHECK(json.find("\"temp\":{\"p\":\"sensor\"") != std::string::npos);
+        CHECK(json.find("\"fan\":{\"p\":\"switch\"") != std::string::npos);
+    }
+    CHECK(client.find("homeassistant/sensor/small/temp/config") == nullptr);
+
+    CHECK(client.find("homeassistant/device/large/config") == nullptr);
+    CHECK_EQ(client.countMatching("homeassistant/sensor/large/"), (size_t)LARGE_SENSORS);
+    CHECK_EQ(client.countMatching("/config"), (size_t)LARGE_SENSORS + 1);
+}
+
+static void testPublishAll() {
+    client.clear();
+    HAComponentManager::publishConfigAll();
+    checkConfigs();
+}
+
+static void testIncremental() {
+    client.clear();
+    HAComponentManager::requestConfigAll();
+    CHECK(!HAComponentManager::isConfigComplete());
+
+    int calls = 0;
+    while (!HAComponentManager::service(8) && calls < 100) {
+        calls++;
+    }
+    CHECK(HAComponentManager::isConfigComplete());
+    // One device config, then the large device's sensors 8 per call
+    CHECK_EQ(calls, (LARGE_SENSORS + 1 + 7) / 8 - 1);
+    checkConfigs();
+}
+
+static void testUnpublish() {
+    client.clear();
+    HAComponentManager::publishConfigAll(false);
+    const PubSubClient::Message* config = client.find("homeassistant/device/small/config");
+    CHECK(config != nullptr && config->length == 0);
+    CHECK(client.find("homeassistant/device/large/config") == nullptr);
+    CHECK_EQ(client.countMatching("/config"), (size_t)LARGE_SENSORS + 1);
+    config = client.find("homeassistant/sensor/large/sensor0/config");
+    CHECK(config != nullptr && config->length == 0);
+}
+
+static void setup(ComponentContext& context, const char* name) {
+    context.mac_address = name;
+    context.device_name = name;
+    context.friendly_name = name;
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+}
+
+int main() {
+    setup(small_device, "small");
+    setup(large_device, "large");
+    for (int i = 0; i < LARGE_SENSORS; i++) {
+        ids.push_back("sensor" + std::to_string(i));
+        const char* id = ids.back().c_str();
+        sensors.emplace_back(new HAComponent<Component::Sensor>(large_device, id, id, 1000, 0.f, SensorClass::Temperature));
+    }
+
+    HAComponentManager::setDeviceDiscovery(true);
+    HAComponentManager::initializeAll();
+    client.setBufferSize(4096);
+    CHECK(client.connect("gateway", nullptr, nullptr));
+
+    testPublishAll();
+    testIncremental();
+    testUnpublish();
+    return harness::finish();
+}
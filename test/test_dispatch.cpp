@@ -0,0 +1,85 @@
+// Switch command dispatch through the hash table built by initializeAll().
+
+#include "harness.h"
+#include <deque>
+#include <memory>
+#include <vector>
+
+#define SWITCHES (100)
+
+PubSubClient client;
+ComponentContext context(client);
+
+static int calls[SWITCHES];
+static bool states[SWITCHES];
+
+static void onSwitch(int i, bool state) {
+    calls[i]++;
+    states[i] = state;
+}
+
+static std::deque<std::string> ids;
+static std::vector<std::unique_ptr<HAComponent<Component::Switch>>> switches;
+
+static int totalCalls() {
+    int n = 0;
+    for (int c : calls) {
+        n += c;
+    }
+    return n;
+}
+
+static void testEverySwitch() {
+    for (int i = 0; i < SWITCHES; i++) {
+        std::string topic = "dev/switch/sw" + std::to_string(i) + "/ctrl";
+        CHECK(client.deliver(topic.c_str(), (i & 1) ? "ON" : "OFF"));
+        CHECK_EQ(calls[i], 1);
+        CHECK_EQ(states[i], (i & 1) != 0);
+    }
+    CHECK_EQ(totalCalls(), SWITCHES);
+}
+
+static void testNonMatching() {
+    int before = totalCalls();
+    client.deliver("dev/switch/sw1", "ON");             // No /ctrl
+    client.deliver("dev/switch/sw1/state", "ON");       // Not a command topic
+    client.deliver("dev/switch/sw1/ctrl/x", "ON");
+    client.deliver("dev/switch/sw100/ctrl", "ON");      // No such switch
+    client.deliver("dev/switch/sw/ctrl", "ON");
+    client.deliver("xdev/switch/sw1/ctrl", "ON");       // Another device
+    client.deliver("/ctrl", "ON");
+    client.deliver("dev/switch/sw1/ctrl", "ONN");       // Invalid payload
+    client.deliver("dev/switch/sw1/ctrl", "");
+    CHECK_EQ(totalCalls(), before);
+}
+
+static void testPayloadNotTerminated() {
+    // "ON" followed by more bytes that aren't part of the payload
+    const uint8_t payload[] = { 'O', 'N', 'X' };
+    CHECK(client.deliver("dev/switch/sw2/ctrl", payload, 2));
+    CHECK_EQ(calls[2], 2);
+    CHECK(states[2]);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+
+    for (int i = 0; i < SWITCHES; i++) {
+        ids.push_back("sw" + std::to_string(i));
+        HASwitchCallback callback = [i](bool state) { onSwitch(i, state); };
+        switches.emplace_back(new HAComponent<Component::Switch>(context, ids.back().c_str(), "Switch", callback));
+    }
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+    client.connect("dev", nullptr, nullptr);
+
+    testEverySwitch();
+    testNonMatching();
+    testPayloadNotTerminated();
+    return harness::finish();
+}
@@ -0,0 +1,142 @@
+// States reported from interrupts (HAEventQueue): edges are coalesced, edges
+// beyond HA_EVENT_QUEUE_SIZE are dropped and counted, and the latest state is
+// still published once the queue has drained. Switches don't call back.
+
+#include "harness.h"
+
+PubSubClient client;
+ComponentContext context(client);
+
+static int relay_calls = 0;
+HAComponent<Component::BinarySensor> door(context, "door", "Door", BinarySensorClass::door);
+HAComponent<Component::Switch> relay(context, "relay", "Relay", [](bool) { relay_calls++; });
+
+// States published to topic since the last clear(), eg. "ON,OFF"
+static std::string published(const char* topic) {
+    std::string states;
+    for (size_t i = 0; i < client.count(); i++) {
+        if (strcmp(client[i].topic, topic) == 0) {
+            states += (states.empty() ? "" : ",") + harness::payload(client[i]);
+        }
+    }
+    return states;
+}
+
+// Alternating edges, starting with the opposite of last
+static std::string alternating(bool last, size_t count) {
+    std::string states;
+    for (size_t i = 0; i < count; i++) {
+        last = !last;
+        states += (i == 0 ? "" : ",") + std::string(last ? "ON" : "OFF");
+    }
+    return states;
+}
+
+static void testCoalescing() {
+    client.clear();
+    door.reportStateFromISR(true);
+    door.reportStateFromISR(true);
+    door.reportStateFromISR(false);
+    door.reportStateFromISR(false);
+    door.reportStateFromISR(false);
+    door.reportStateFromISR(true);
+
+    // Nothing is published from the interrupt itself
+    CHECK_EQ(client.count(), (size_t)0);
+    HAComponentManager::service();
+    CHECK_STR(published("dev/binary_sensor/door/state"), "ON,OFF,ON");
+    CHECK_EQ(door.getInterruptOverflows(), 0u);
+
+    // Repeating the last state drained isn't an edge either
+    client.clear();
+    door.reportStateFromISR(true);
+    HAComponentManager::service();
+    CHECK_STR(published("dev/binary_sensor/door/state"), "");
+}
+
+// More edges than fit: the first HA_EVENT_QUEUE_SIZE in order, then the latest
+// state if it differs from the last one queued
+static void testOverflow(size_t edges) {
+    client.clear();
+    uint32_t overflows = door.getInterruptOverflows();
+    bool state = false;  // Last drained
+    for (size_t i = 0; i < edges; i++) {
+        state = !state;
+        door.reportStateFromISR(state);
+    }
+    CHECK_EQ(door.getInterruptOverflows() - overflows, (uint32_t)(edges - HA_EVENT_QUEUE_SIZE));
+
+    HAComponentManager::service();
+    std::string expected = alternating(false, HA_EVENT_QUEUE_SIZE);
+    bool last_queued = (HA_EVENT_QUEUE_SIZE % 2) != 0;
+    if (state != last_queued) {
+        expected += state ? ",ON" : ",OFF";
+    }
+    CHECK_STR(published("dev/binary_sensor/door/state"), expected.c_str());
+
+    // The catch-up is reported once, and the queue is usable again
+    client.clear();
+    HAComponentManager::service();
+    CHECK_STR(published("dev/binary_sensor/door/state"), "");
+    door.reportStateFromISR(!state);
+    door.reportStateFromISR(state);
+    HAComponentManager::service();
+    CHECK_STR(published("dev/binary_sensor/door/state"), state ? "OFF,ON" : "ON,OFF");
+    CHECK_EQ(door.getInterruptOverflows() - overflows, (uint32_t)(edges - HA_EVENT_QUEUE_SIZE));
+
+    // Back to OFF for the next run
+    if (state) {
+        door.reportStateFromISR(false);
+        HAComponentManager::service();
+    }
+}
+
+static void testSwitch() {
+    client.clear();
+    relay.reportStateFromISR(true);
+    relay.reportStateFromISR(false);
+    relay.reportStateFromISR(true);
+    HAComponentManager::service();
+    CHECK_STR(published("dev/switch/relay/state"), "ON,OFF,ON");
+    CHECK_EQ(relay_calls, 0);
+
+    client.clear();
+    for (size_t i = 0; i < HA_EVENT_QUEUE_SIZE + 3; i++) {
+        relay.reportStateFromISR(i % 2 != 0);
+    }
+    CHECK_EQ(relay.getInterruptOverflows(), 3u);
+    HAComponentManager::service();
+    CHECK_STR(published("dev/switch/relay/state"), (alternating(true, HA_EVENT_QUEUE_SIZE) + ",OFF").c_str());
+    CHECK_EQ(relay_calls, 0);
+
+    // Commands from HA still do
+    CHECK(client.deliver("dev/switch/relay/ctrl", "OFF"));
+    CHECK_EQ(relay_calls, 1);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    // Every drained state is published, unchanged or not
+    HAComponentManager::setStateRefresh(0);
+    door.enableInterruptQueue();
+    relay.enableInterruptQueue();
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+    CHECK(client.connect("dev", nullptr, nullptr));
+    HAComponentManager::publishConfigAll();
+    HAComponentManager::service();
+
+    testCoalescing();
+    door.reportStateFromISR(false);
+    HAComponentManager::service();
+
+    testOverflow(HA_EVENT_QUEUE_SIZE + 1);
+    testOverflow(HA_EVENT_QUEUE_SIZE + 2);
+    testOverflow(3 * HA_EVENT_QUEUE_SIZE);
+    testOverflow(3 * HA_EVENT_QUEUE_SIZE + 1);
+    testSwitch();
+    return harness::finish();
+}
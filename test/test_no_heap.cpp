@@ -0,0 +1,66 @@
+// With HA_NO_HEAP, nothing allocates after static initialization.
+
+#include "harness.h"
+
+#ifndef HA_NO_HEAP
+#error "Build with HA_NO_HEAP"
+#endif
+
+PubSubClient client;
+ComponentContext context(client);
+
+struct Fan {
+    bool on = false;
+} fan;
+
+HAAvailabilityComponent availability(context);
+HAComponent<Component::Sensor> temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+HAComponent<Component::Sensor> humidity(context, "humid", "Humidity", 1000, 0.f, SensorClass::Humidity);
+HAComponent<Component::BinarySensor> door(context, "door", "Door", BinarySensorClass::door);
+HAComponent<Component::Switch> fan_switch(context, "fan", "Fan",
+    HASwitchCallback([](void* ctx, bool state) { static_cast<Fan*>(ctx)->on = state; }, &fan));
+HAComponent<Component::Switch> light(context, "light", "Light", [](bool state) { });
+HAStatsComponent stats(context, 1000);
+HASensorGroup env(context, "env");
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+    context.fw_version = "1.0.0";
+    context.model = "Model";
+    context.manufacturer = "Maker";
+    humidity.setGroup(env);
+
+    size_t allocations = harness::allocations();
+
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+    HAComponentManager::connectClientWithAvailability(client, "dev", "user", "pass");
+    HAComponentManager::publishConfigAll();
+    CHECK_EQ(client.countMatching("/config"), (size_t)7);
+
+    for (int i = 0; i < 100; i++) {
+        advanceMillis(100);
+        temperature.update(20.f + i * 0.1f);
+        humidity.update(50.f);
+    }
+    door.reportState(true);
+    client.deliver("dev/switch/fan/ctrl", "ON");
+    client.deliver("dev/switch/light/ctrl", "ON");
+    for (int i = 0; i < 100; i++) {
+        advanceMillis(100);
+        HAComponentManager::service();
+    }
+    CHECK(fan.on);
+    const PubSubClient::Message* state = client.find("dev/switch/fan/state");
+    CHECK(state != nullptr && state->payloadIs("ON"));
+    CHECK(client.find("dev/sensor/temp/state") != nullptr);
+    CHECK(client.find("dev/sensor/env/state") != nullptr);
+    CHECK(client.find("dev/sensor/stats/state") != nullptr);
+
+    HAComponentManager::publishConfigAll(false);
+
+    CHECK_EQ(harness::allocations() - allocations, (size_t)0);
+    return harness::finish();
+}
@@ -0,0 +1,92 @@
+// HA_OFFLINE_BUFFER_SIZE: samples reported while disconnected are kept
+// (dropping the oldest when full) and replayed in batches, with the time
+// they were sampled, to <device>/sensor/<id>/history after reconnecting.
+
+#include "harness.h"
+
+#if HA_OFFLINE_BUFFER_SIZE != 4 || HA_OFFLINE_REPLAY_BATCH != 2
+#error "Build with HA_OFFLINE_BUFFER_SIZE=4 and HA_OFFLINE_REPLAY_BATCH=2"
+#endif
+
+PubSubClient client;
+ComponentContext context(client);
+HAComponent<Component::Sensor> temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+
+static const uint32_t EPOCH = 1700000000;
+
+// One sample per report interval
+static void sample(float value) {
+    advanceMillis(1000);
+    temperature.update(value);
+    HAComponentManager::service();
+}
+
+static void checkHistory(size_t i, uint32_t ts, const char* value) {
+    CHECK(i < client.count());
+    if (i < client.count()) {
+        CHECK_STR(client[i].topic, "dev/sensor/temp/history");
+        char expected[64];
+        snprintf(expected, sizeof(expected), "{\"ts\":%lu,\"val\":%s}", (unsigned long)ts, value);
+        CHECK_STR(harness::payload(client[i]), expected);
+        CHECK(!client[i].retain);
+    }
+}
+
+static void testBuffering() {
+    sample(20.f);
+    CHECK(client.find("dev/sensor/temp/state") != nullptr);
+
+    // Six reports while disconnected: the first two are dropped
+    client.disconnect();
+    client.clear();
+    uint32_t first_ts = HAComponentManager::timestamp() + 1;
+    for (int i = 0; i < 6; i++) {
+        sample(21.f + i);
+    }
+    CHECK_EQ(client.count(), (size_t)0);
+    CHECK_EQ(HAOfflineBuffer::size(), (size_t)4);
+    CHECK_EQ(HAOfflineBuffer::dropped(), 2u);
+
+    // Not replayed while publishes fail
+    CHECK(client.connect("dev", nullptr, nullptr));
+    client.setFailing(true);
+    HAComponentManager::service();
+    CHECK_EQ(HAOfflineBuffer::size(), (size_t)4);
+    client.setFailing(false);
+
+    // Oldest first, HA_OFFLINE_REPLAY_BATCH per service()
+    client.clear();
+    HAComponentManager::service();
+    CHECK_EQ(client.count(), (size_t)2);
+    checkHistory(0, first_ts + 2, "23.00");
+    checkHistory(1, first_ts + 3, "24.00");
+    CHECK_EQ(HAOfflineBuffer::size(), (size_t)2);
+
+    client.clear();
+    HAComponentManager::service();
+    CHECK_EQ(client.count(), (size_t)2);
+    checkHistory(0, first_ts + 4, "25.00");
+    checkHistory(1, first_ts + 5, "26.00");
+    CHECK_EQ(HAOfflineBuffer::size(), (size_t)0);
+
+    // Then back to live states
+    client.clear();
+    sample(30.f);
+    CHECK(client.find("dev/sensor/temp/history") == nullptr);
+    const PubSubClient::Message* state = client.find("dev/sensor/temp/state");
+    CHECK(state != nullptr && state->payloadIs("30.00"));
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+    HAComponentManager::setTimeSource([]() { return EPOCH + (uint32_t)(millis() / 1000); });
+
+    HAComponentManager::initializeAll();
+    CHECK(client.connect("dev", nullptr, nullptr));
+    HAComponentManager::service();
+
+    testBuffering();
+    return harness::finish();
+}
@@ -0,0 +1,78 @@
+// Rediscovery on HA's birth message (HAComponentManager::setRediscoverOnBirth):
+// "online" on HA_STATUS_TOPIC republishes every config within
+// HA_REDISCOVERY_JITTER_MS, anything else is ignored.
+
+#include "harness.h"
+
+#define STEP_MS (50)
+
+PubSubClient client;
+ComponentContext context(client);
+
+HAComponent<Component::Sensor> temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+HAComponent<Component::Switch> fan(context, "fan", "Fan", [](bool) { });
+
+static const char* const temp_topic = HA_CONFIG_TOPIC("sensor", "dev", "temp");
+static const char* const fan_topic = HA_CONFIG_TOPIC("switch", "dev", "fan");
+
+// Run service() every STEP_MS for ms, returning when the first config went out
+static long serviceFor(unsigned long ms) {
+    for (unsigned long elapsed = 0; elapsed <= ms; elapsed += STEP_MS) {
+        HAComponentManager::service();
+        if (client.countMatching("/config") > 0) {
+            return (long)elapsed;
+        }
+        advanceMillis(STEP_MS);
+    }
+    return -1;
+}
+
+static void testOnline() {
+    for (int i = 0; i < 3; i++) {
+        client.clear();
+        CHECK(client.deliver(HA_STATUS_TOPIC, "online"));
+        CHECK_EQ(client.count(), (size_t)0);
+
+        long delay = serviceFor(HA_REDISCOVERY_JITTER_MS);
+        CHECK(delay >= 0 && delay < HA_REDISCOVERY_JITTER_MS);
+        while (!HAComponentManager::isConfigComplete()) {
+            HAComponentManager::service();
+        }
+        const PubSubClient::Message* config = client.find(temp_topic);
+        CHECK(config != nullptr && config->retain && config->length > 0);
+        config = client.find(fan_topic);
+        CHECK(config != nullptr && config->retain && config->length > 0);
+        CHECK_EQ(client.countMatching("/config"), (size_t)2);
+
+        // Once per birth message
+        client.clear();
+        CHECK_EQ(serviceFor(2 * HA_REDISCOVERY_JITTER_MS), -1L);
+    }
+}
+
+static void testOffline() {
+    client.clear();
+    CHECK(client.deliver(HA_STATUS_TOPIC, "offline"));
+    CHECK_EQ(serviceFor(2 * HA_REDISCOVERY_JITTER_MS), -1L);
+    CHECK_EQ(client.count(), (size_t)0);
+}
+
+int main() {
+    static_assert(HA_REDISCOVERY_JITTER_MS > STEP_MS, "The jitter window must span several steps");
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    HAComponentManager::setRediscoverOnBirth(true);
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+    client.setBufferSize(1024);
+    CHECK(HAComponentManager::connectClientWithAvailability(client, "dev", nullptr, nullptr));
+    CHECK(client.isSubscribed(HA_STATUS_TOPIC));
+    HAComponentManager::publishConfigAll();
+    setMillis(1000);
+
+    testOnline();
+    testOffline();
+    return harness::finish();
+}
@@ -0,0 +1,146 @@
+// Sensor reporting policies: deadband, max silence and swinging door.
+// Each sensor gets one sample per (1 s) report interval.
+
+#include "harness.h"
+#include <vector>
+
+PubSubClient client;
+ComponentContext context(client);
+
+HAComponent<Component::Sensor> absolute(context, "absolute", "Absolute", 1000, 0.5f);
+HAComponent<Component::Sensor> percent(context, "percent", "Percent", 1000);
+HAComponent<Component::Sensor> heartbeat(context, "heartbeat", "Heartbeat", 1000);
+HAComponent<Component::Sensor> door(context, "door", "Door", 1000);
+
+static const float TOLERANCE = 0.5f;
+
+// Advance to the next interval and return whether sensor published value
+static bool sample(HAComponent<Component::Sensor>& sensor, float value, const char* expected = nullptr) {
+    client.clear();
+    advanceMillis(1000);
+    sensor.update(value);
+    if (client.count() == 0) {
+        return false;
+    }
+    if (expected != nullptr) {
+        CHECK_STR(harness::payload(client[0]), expected);
+    }
+    return true;
+}
+
+static void testDeadband() {
+    CHECK(sample(absolute, 10.f, "10.00"));
+    CHECK(!sample(absolute, 10.4f));
+    CHECK(sample(absolute, 10.6f, "10.60"));
+    // Measured from the last reported value, not the last sample
+    CHECK(!sample(absolute, 10.2f));
+    CHECK(sample(absolute, 10.1f, "10.10"));
+
+    percent.setDeadband(10.f, true);
+    CHECK(sample(percent, 100.f, "100.00"));
+    CHECK(!sample(percent, 109.f));
+    CHECK(sample(percent, 89.f, "89.00"));
+    CHECK(!sample(percent, 97.f));
+}
+
+static void testMaxSilence() {
+    heartbeat.setDeadband(1.f);
+    heartbeat.setMaxSilence(3000);
+    CHECK(sample(heartbeat, 5.f, "5.00"));
+    CHECK(!sample(heartbeat, 5.1f));
+    CHECK(!sample(heartbeat, 5.2f));
+    CHECK(sample(heartbeat, 5.3f, "5.30"));
+
+    // Without samples (only non-finite ones) the last value is repeated
+    client.clear();
+    advanceMillis(3000);
+    const float nan = NAN;
+    heartbeat.update(&nan, 1);
+    CHECK_EQ(client.count(), (size_t)1);
+    if (client.count() == 1) {
+        CHECK_STR(harness::payload(client[0]), "5.30");
+    }
+}
+
+struct Point {
+    double ts;
+    double value;
+};
+
+// Parse {"val":<value>,"ts":<timestamp>}
+static bool parsePoint(const std::string& payload, Point& point) {
+    return sscanf(payload.c_str(), "{\"val\":%lf,\"ts\":%lf}", &point.value, &point.ts) == 2;
+}
+
+static void testSwingingDoor() {
+    client.clear();
+    door.setSwingingDoor(TOLERANCE);
+    door.publishConfig();
+    const PubSubClient::Message* config = client.find("homeassistant/sensor/dev/door/config");
+    CHECK(config != nullptr);
+    if (config != nullptr) {
+        std::string json = harness::payload(*config);
+        CHECK(json.find("\"val_tpl\":\"{{ value_json.val }}\"") != std::string::npos);
+        CHECK(json.find("\"json_attr_t\":\"dev/sensor/door/state\"") != std::string::npos);
+        CHECK(json.find("frc_upd") == std::string::npos);
+    }
+
+    // Ramps, a plateau, a step and a wave
+    std::vector<Point> trace;
+    std::vector<Point> reported;
+    for (int i = 0; i < 400; i++) {
+        double value = (i < 100) ? i * 0.1 : (i < 150) ? 10.0 : (i < 200) ? 15.0 - (i - 150) * 0.05 : 12.0 + 4.0 * sin(i * 0.07);
+        advanceMillis(1000);
+        trace.push_back({ (double)HAComponentManager::timestamp(), value });
+
+        client.clear();
+        door.update((float)value);
+        Point point;
+        for (size_t m = 0; m < client.count(); m++) {
+            CHECK(parsePoint(harness::payload(client[m]), point));
+            reported.push_back(point);
+        }
+    }
+
+    // Far fewer messages than samples, each reported point is a past sample
+    CHECK(reported.size() > 4 && reported.size() < trace.size() / 4);
+    CHECK_EQ(reported.front().ts, trace.front().ts);
+    for (size_t i = 1; i < reported.size(); i++) {
+        CHECK(reported[i].ts > reported[i - 1].ts);
+    }
+
+    // Interpolating between reported points stays within tolerance
+    // (plus the rounding to two decimals at both ends)
+    double max_error = 0.0;
+    size_t segment = 0;
+    for (const Point& actual : trace) {
+        if (actual.ts > reported.back().ts) {
+            break;
+        }
+        while (actual.ts > reported[segment + 1].ts) {
+            segment++;
+        }
+        const Point& a = reported[segment];
+        const Point& b = reported[segment + 1];
+        double estimate = a.value + (b.value - a.value) * (actual.ts - a.ts) / (b.ts - a.ts);
+        max_error = std::max(max_error, fabs(estimate - actual.value));
+    }
+    CHECK(max_error <= TOLERANCE + 0.01);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    HAComponentManager::initializeAll();
+    CHECK(client.connect("dev", nullptr, nullptr));
+
+    // Sample mid-interval, so every update() is past the next deadline
+    setMillis(100000 + 500);
+
+    testDeadband();
+    testMaxSilence();
+    testSwingingDoor();
+    return harness::finish();
+}
@@ -0,0 +1,113 @@
+// State deduplication in publishState: a payload identical to the last one
+// published is suppressed until the refresh interval (setStateRefresh) has
+// passed or the client reconnects, unless forced.
+
+#include "harness.h"
+
+#define REFRESH_MS (60000)
+
+PubSubClient client;
+ComponentContext context(client);
+HAComponent<Component::Switch> relay(context, "relay", "Relay", [](bool) { });
+
+static const char* const state_topic = HA_STATE_TOPIC("dev", "switch", "relay");
+
+static uint32_t suppressed() {
+    CHECK_EQ(relay.getStats().suppressed, HAComponentManager::getGlobalStats().suppressed);
+    return relay.getStats().suppressed;
+}
+
+// Whether publishing value went out, checked against the recorded messages
+static bool publish(const char* value, bool force = false) {
+    client.clear();
+    CHECK(relay.publishState(value, true, force));
+    const PubSubClient::Message* state = client.find(state_topic);
+    CHECK(state == nullptr || state->payloadIs(value));
+    return state != nullptr;
+}
+
+static void testIdentical() {
+    uint32_t before = suppressed();
+    CHECK(publish("ON"));
+    CHECK(!publish("ON"));
+    CHECK(!publish("ON"));
+    CHECK_EQ(suppressed() - before, 2u);
+
+    // Any change goes out, and is then the payload compared against
+    CHECK(publish("OFF"));
+    CHECK(publish("ON"));
+    CHECK(!publish("ON"));
+    CHECK_EQ(suppressed() - before, 3u);
+}
+
+static void testRefresh() {
+    CHECK(publish("OFF"));
+    advanceMillis(REFRESH_MS - 1);
+    CHECK(!publish("OFF"));
+
+    // Counted from the last publish, not the last suppressed one
+    advanceMillis(1);
+    CHECK(publish("OFF"));
+    advanceMillis(REFRESH_MS / 2);
+    CHECK(!publish("OFF"));
+}
+
+static void testReconnect() {
+    CHECK(publish("ON"));
+    CHECK(!publish("ON"));
+
+    // A new session (and possibly a new broker) gets every state again
+    client.disconnect();
+    CHECK(HAComponentManager::connectClientWithAvailability(client, "dev", nullptr, nullptr));
+    CHECK(publish("ON"));
+    CHECK(!publish("ON"));
+}
+
+static void testForce() {
+    uint32_t before = suppressed();
+    CHECK(publish("OFF"));
+    CHECK(publish("OFF", true));
+    CHECK(publish("OFF", true));
+    CHECK_EQ(suppressed(), before);
+
+    // A forced publish restarts the interval
+    advanceMillis(REFRESH_MS - 1);
+    CHECK(!publish("OFF"));
+}
+
+static void testFailed() {
+    // A failed publish isn't remembered, so the retry goes out
+    CHECK(publish("ON"));
+    client.setFailing(true);
+    client.clear();
+    CHECK(!relay.publishState("OFF"));
+    client.setFailing(false);
+    CHECK(publish("OFF"));
+}
+
+static void testDisabled() {
+    HAComponentManager::setStateRefresh(0);
+    uint32_t before = suppressed();
+    CHECK(publish("ON"));
+    CHECK(publish("ON"));
+    CHECK_EQ(suppressed(), before);
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    HAComponentManager::setStateRefresh(REFRESH_MS);
+    HAComponentManager::initializeAll();
+    CHECK(HAComponentManager::connectClientWithAvailability(client, "dev", nullptr, nullptr));
+    setMillis(1000);
+
+    testIdentical();
+    testRefresh();
+    testReconnect();
+    testForce();
+    testFailed();
+    testDisabled();
+    return harness::finish();
+}
@@ -0,0 +1,83 @@
+// Performance counters: the command latency histogram (log2 microsecond
+// buckets) and the HAStatsComponent payload published from service().
+
+#include "harness.h"
+
+PubSubClient client;
+ComponentContext context(client);
+
+// Simulated time spent in the switch callback
+static unsigned long delay_ms = 0;
+HAComponent<Component::Switch> relay(context, "relay", "Relay", [](bool) { advanceMillis(delay_ms); });
+HAStatsComponent stats(context, 10000);
+
+static void command(unsigned long ms, const char* payload) {
+    delay_ms = ms;
+    CHECK(client.deliver("dev/switch/relay/ctrl", payload));
+}
+
+static void testHistogram() {
+    command(0, "ON");       // 0 us
+    command(0, "OFF");
+    command(1, "ON");       // 1000 us: [512, 1024)
+    command(3, "OFF");      // 3000 us: [2048, 4096)
+    command(3, "ON");
+    command(100, "OFF");    // 100000 us: last bucket
+    command(1, "maybe");    // Invalid, not counted
+
+    const uint32_t* hist = HAComponentManager::getLatencyHistogram();
+    uint32_t expected[HA_LATENCY_BUCKETS] = { };
+    expected[0] = 2;
+    expected[9] = 1;
+    expected[11] = 2;
+    expected[HA_LATENCY_BUCKETS - 1] = 1;
+    for (size_t i = 0; i < HA_LATENCY_BUCKETS; i++) {
+        CHECK_EQ(hist[i], expected[i]);
+    }
+    CHECK_EQ(HAComponentManager::getGlobalStats().commands, 6u);
+    CHECK_EQ(relay.getStats().commands, 6u);
+}
+
+static void testPayload() {
+    const PubSubClient::Message* config = client.find(HA_CONFIG_TOPIC("sensor", "dev", "stats"));
+    CHECK(config != nullptr);
+    if (config != nullptr) {
+        std::string json = harness::payload(*config);
+        CHECK(json.find("\"json_attr_t\":\"dev/sensor/stats/state\"") != std::string::npos);
+        CHECK(json.find("\"ent_cat\":\"diagnostic\"") != std::string::npos);
+    }
+
+    // Counters as of just before the stats themselves are published
+    const HAStats snapshot = HAComponentManager::getGlobalStats();
+    client.clear();
+    advanceMillis(10000);
+    HAComponentManager::service();
+
+    const PubSubClient::Message* state = client.find("dev/sensor/stats/state");
+    CHECK(state != nullptr && !state->retain);
+    char expected[256];
+    snprintf(expected, sizeof(expected),
+        "{\"publishes\":%lu,\"failed\":%lu,\"bytes\":%lu,\"suppressed\":%lu,\"commands\":6,"
+        "\"latency_us\":[2,0,0,0,0,0,0,0,0,1,0,2,0,0,0,1]}",
+        (unsigned long)snapshot.publishes, (unsigned long)snapshot.failed,
+        (unsigned long)snapshot.bytes, (unsigned long)snapshot.suppressed);
+    CHECK_STR(state != nullptr ? harness::payload(*state) : std::string(), expected);
+    CHECK_EQ(HAComponentManager::getGlobalStats().publishes, snapshot.publishes + 1);
+}
+
+int main() {
+    static_assert(HA_LATENCY_BUCKETS == 16, "The expected payload assumes 16 buckets");
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+
+    HAComponentManager::initializeAll();
+    client.setCallback(HAComponentManager::onMessageReceived);
+    CHECK(client.connect("dev", nullptr, nullptr));
+    HAComponentManager::publishConfigAll();
+    HAComponentManager::service();
+
+    testHistogram();
+    testPayload();
+    return harness::finish();
+}
@@ -0,0 +1,86 @@
+// Topics and unique ids built at runtime match the HA_*_TOPIC macros, and
+// device classes and units come through from the flash tables.
+
+#include "harness.h"
+
+PubSubClient client;
+ComponentContext context(client);
+
+HAComponent<Component::Sensor> temperature(context, "temp", "Temperature", 1000, 0.f, SensorClass::Temperature);
+HAComponent<Component::Sensor> dust(context, "dust", "Dust", 1000, 0.f, SensorClass::Dust);
+HAComponent<Component::Sensor> humidity(context, "humid", "Humidity", 1000, 0.f, SensorClass::Humidity);
+HAComponent<Component::BinarySensor> window(context, "window", "Window", BinarySensorClass::window);
+HAComponent<Component::BinarySensor> button(context, "button", "Button");
+HAComponent<Component::Switch> fan(context, "fan", "Fan", [](bool) { });
+HAComponent<Component::Counter> energy(context, "energy", "Energy", 1000, 1000.f, "kWh", "energy");
+HACounterRate power(context, "energy", "power", "Power", "W", 1000.f, "power");
+HASensorGroup env(context, "env");
+
+static std::string config(const char* topic) {
+    const PubSubClient::Message* message = client.find(topic);
+    CHECK(message != nullptr);
+    return (message != nullptr) ? harness::payload(*message) : std::string();
+}
+
+static bool contains(const std::string& json, const char* key, const char* value) {
+    return json.find(std::string("\"") + key + "\":\"" + value + "\"") != std::string::npos;
+}
+
+static void testTopics() {
+    std::string json = config(HA_CONFIG_TOPIC("sensor", "dev", "temp"));
+    CHECK(contains(json, "stat_t", HA_STATE_TOPIC("dev", "sensor", "temp")));
+    CHECK(contains(json, "unique_id", HA_UNIQUE_ID("dev", "temp")));
+
+    json = config(HA_CONFIG_TOPIC("switch", "dev", "fan"));
+    CHECK(contains(json, "stat_t", HA_STATE_TOPIC("dev", "switch", "fan")));
+    CHECK(contains(json, "cmd_t", HA_COMMAND_TOPIC("dev", "fan")));
+    CHECK(client.isSubscribed(HA_COMMAND_TOPIC("dev", "fan")));
+
+    json = config(HA_CONFIG_TOPIC("binary_sensor", "dev", "window"));
+    CHECK(contains(json, "stat_t", HA_STATE_TOPIC("dev", "binary_sensor", "window")));
+
+    // The rate reads the counter's state, grouped sensors the group's
+    json = config(HA_CONFIG_TOPIC("sensor", "dev", "power"));
+    CHECK(contains(json, "stat_t", HA_STATE_TOPIC("dev", "sensor", "energy")));
+    json = config(HA_CONFIG_TOPIC("sensor", "dev", "humid"));
+    CHECK(contains(json, "stat_t", HA_STATE_TOPIC("dev", "sensor", "env")));
+    // Subscript, as ids needn't be valid Jinja identifiers
+    CHECK(contains(json, "val_tpl", "{{ value_json['humid'] }}"));
+}
+
+static void testClasses() {
+    std::string json = config(HA_CONFIG_TOPIC("sensor", "dev", "temp"));
+    CHECK(contains(json, "dev_cla", "temperature"));
+    CHECK(contains(json, "unit_of_meas", "°C"));
+
+    // Custom class: units only
+    json = config(HA_CONFIG_TOPIC("sensor", "dev", "dust"));
+    CHECK(json.find("\"dev_cla\"") == std::string::npos);
+    CHECK(contains(json, "unit_of_meas", "ug/m³"));
+
+    json = config(HA_CONFIG_TOPIC("binary_sensor", "dev", "window"));
+    CHECK(contains(json, "dev_cla", "window"));
+    json = config(HA_CONFIG_TOPIC("binary_sensor", "dev", "button"));
+    CHECK(json.find("\"dev_cla\"") == std::string::npos);
+
+    // Counters take free-form classes
+    json = config(HA_CONFIG_TOPIC("sensor", "dev", "energy"));
+    CHECK(contains(json, "dev_cla", "energy"));
+    json = config(HA_CONFIG_TOPIC("sensor", "dev", "power"));
+    CHECK(contains(json, "dev_cla", "power"));
+}
+
+int main() {
+    context.mac_address = "AA:BB:CC:DD:EE:FF";
+    context.device_name = "dev";
+    context.friendly_name = "Device";
+    humidity.setGroup(env);
+
+    HAComponentManager::initializeAll();
+    CHECK(client.connect("dev", nullptr, nullptr));
+    HAComponentManager::publishConfigAll();
+
+    testTopics();
+    testClasses();
+    return harness::finish();
+}
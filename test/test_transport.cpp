@@ -0,0 +1,94 @@
+// Transports: service() loops each transport once however many devices
+// share it, queued publishes are drained in batches, and the
+// loopback transport delivers commands back to the components.
+
+#include "harness.h"
+
+#if HA_TRANSPORT_DRAIN_BATCH != 2
+#error "Build with HA_TRANSPORT_DRAIN_BATCH=2"
+#endif
+
+class CountingLoopback : public HALoopbackTransport {
+public:
+    int loops = 0;
+    void loop() override { loops++; }
+};
+
+// Two devices on one queue
+PubSubClient queued_client;
+HAPubSubTransport pubsub(&queued_client);
+HAQueuedTransport queued(pubsub);
+ComponentContext hall(queued);
+ComponentContext porch(queued);
+HAComponent<Component::BinarySensor> hall_motion(hall, "motion", "Motion");
+HAComponent<Component::BinarySensor> hall_door(hall, "door", "Door");
+HAComponent<Component::BinarySensor> porch_motion(porch, "motion", "Motion");
+
+// Two devices on one loopback
+CountingLoopback loopback;
+ComponentContext lamp(loopback);
+ComponentContext heater(loopback);
+static bool lamp_state = false;
+HAComponent<Component::Switch> lamp_switch(lamp, "light", "Light", [](bool state) { lamp_state = state; });
+HAComponent<Component::Switch> heater_switch(heater, "power", "Power", [](bool) { });
+
+static void testLoopOnce() {
+    loopback.loops = 0;
+    HAComponentManager::service();
+    CHECK_EQ(loopback.loops, 1);
+    HAComponentManager::service();
+    CHECK_EQ(loopback.loops, 2);
+}
+
+static void testQueued() {
+    CHECK(queued_client.connect("queued", nullptr, nullptr));
+    queued_client.clear();
+    hall_motion.reportState(true);
+    hall_door.reportState(true);
+    porch_motion.reportState(true);
+    CHECK_EQ(queued.getQueued(), (size_t)3);
+    CHECK_EQ(queued_client.count(), (size_t)0);
+
+    // One batch per service(), not one per device
+    HAComponentManager::service();
+    CHECK_EQ(queued_client.count(), (size_t)2);
+    HAComponentManager::service();
+    CHECK_EQ(queued_client.count(), (size_t)3);
+    CHECK_EQ(queued.getQueued(), (size_t)0);
+    const PubSubClient::Message* state = queued_client.find("porch/binary_sensor/motion/state");
+    CHECK(state != nullptr && state->payloadIs("ON"));
+}
+
+static void testLoopback() {
+    CHECK(loopback.connect("loopback", nullptr, nullptr));
+    HAComponentManager::publishConfigAll(lamp);
+
+    // The command is delivered to the switch, which reports its new state
+    CHECK(loopback.publish("lamp/switch/light/ctrl", "ON", false));
+    CHECK(lamp_state);
+    CHECK_STR(loopback.getLastTopic(), "lamp/switch/light/state");
+    CHECK_STR((const char*)loopback.getLastPayload(), "ON");
+
+    // Not subscribed: heater's config wasn't published
+    loopback.publish("heater/switch/power/ctrl", "ON", false);
+    CHECK_STR(loopback.getLastTopic(), "heater/switch/power/ctrl");
+}
+
+static void setup(ComponentContext& context, const char* name) {
+    context.mac_address = name;
+    context.device_name = name;
+    context.friendly_name = name;
+}
+
+int main() {
+    setup(hall, "hall");
+    setup(porch, "porch");
+    setup(lamp, "lamp");
+    setup(heater, "heater");
+    HAComponentManager::initializeAll();
+
+    testLoopOnce();
+    testQueued();
+    testLoopback();
+    return harness::finish();
+}